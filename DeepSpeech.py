@@ -687,9 +687,12 @@ def test():
         json.dump(samples, open(FLAGS.test_output_file, 'w'), default=float)
 
 
-def create_inference_graph(batch_size=1, n_steps=16, tflite=False):
+def create_inference_graph(batch_size=1, n_steps=16, dynamic_steps=False, tflite=False):
     batch_size = batch_size if batch_size > 0 else None
 
+    if dynamic_steps and tflite:
+        raise NotImplementedError('dynamic_steps is not supported by tflite, its static RNN needs a fixed n_steps')
+
     # Create feature computation graph
     input_samples = tfv1.placeholder(tf.float32, [Config.audio_window_samples], 'input_samples')
     samples = tf.expand_dims(input_samples, -1)
@@ -699,8 +702,11 @@ def create_inference_graph(batch_size=1, n_steps=16, tflite=False):
     # Input tensor will be of shape [batch_size, n_steps, 2*n_context+1, n_input]
     # This shape is read by the native_client in DS_CreateModel to know the
     # value of n_steps, n_context and n_input. Make sure you update the code
-    # there if this shape is changed.
-    input_tensor = tfv1.placeholder(tf.float32, [batch_size, n_steps if n_steps > 0 else None, 2 * Config.n_context + 1, Config.n_input], name='input_node')
+    # there if this shape is changed. With dynamic_steps, the time dimension is
+    # left unknown so that clients can run any number of steps at once, and
+    # n_steps is only exported as metadata for streaming.
+    time_dim = n_steps if n_steps > 0 and not dynamic_steps else None
+    input_tensor = tfv1.placeholder(tf.float32, [batch_size, time_dim, 2 * Config.n_context + 1, Config.n_input], name='input_node')
     seq_length = tfv1.placeholder(tf.int32, [batch_size], name='input_lengths')
 
     if batch_size <= 0:
@@ -729,10 +735,11 @@ def create_inference_graph(batch_size=1, n_steps=16, tflite=False):
                                   rnn_impl=rnn_impl)
 
     # TF Lite runtime will check that input dimensions are 1, 2 or 4
-    # by default we get 3, the middle one being batch_size which is forced to
-    # one on inference graph, so remove that dimension
+    # by default we get 3, the middle one being batch_size, so merge the time
+    # and batch dimensions. The native client reads it back as
+    # [n_steps * batch_size, n_classes], time-major.
     if tflite:
-        logits = tf.squeeze(logits, [1])
+        logits = tf.reshape(logits, [-1, Config.n_hidden_6])
 
     # Apply softmax for CTC decoder
     logits = tf.nn.softmax(logits, name='logits')
@@ -787,7 +794,14 @@ def export():
     log_info('Exporting the model...')
     from tensorflow.python.framework.ops import Tensor, Operation
 
-    inputs, outputs, _ = create_inference_graph(batch_size=FLAGS.export_batch_size, n_steps=FLAGS.n_steps, tflite=FLAGS.export_tflite)
+    # --export_zip implies --export_tflite, so this can't be checked with the other flags
+    if FLAGS.export_dynamic_steps and FLAGS.export_tflite:
+        log_error('--export_dynamic_steps is not supported with TF Lite exports '
+                  '(--export_tflite or --export_zip), whose static RNN needs a fixed --n_steps.')
+        sys.exit(1)
+
+    dynamic_steps = FLAGS.export_dynamic_steps
+    inputs, outputs, _ = create_inference_graph(batch_size=FLAGS.export_batch_size, n_steps=FLAGS.n_steps, dynamic_steps=dynamic_steps, tflite=FLAGS.export_tflite)
 
     graph_version = int(file_relative_read('GRAPH_VERSION').strip())
     assert graph_version > 0
@@ -798,6 +812,9 @@ def export():
     outputs['metadata_feature_win_step'] = tf.constant([FLAGS.feature_win_step], name='metadata_feature_win_step')
     outputs['metadata_alphabet'] = tf.constant([Config.alphabet.serialize()], name='metadata_alphabet')
 
+    if dynamic_steps:
+        outputs['metadata_n_steps'] = tf.constant([FLAGS.n_steps], name='metadata_n_steps')
+
     if FLAGS.export_language:
         outputs['metadata_language'] = tf.constant([FLAGS.export_language.encode('utf-8')], name='metadata_language')
 
@@ -2,6 +2,7 @@
 # -*- coding: utf-8 -*-
 from __future__ import absolute_import, division, print_function
 
+import collections
 import itertools
 import json
 
@@ -13,7 +14,7 @@ import progressbar
 import tensorflow as tf
 import tensorflow.compat.v1 as tfv1
 
-from ds_ctcdecoder import ctc_beam_search_decoder_batch, Scorer
+from ds_ctcdecoder import DecoderPool, Scorer
 from six.moves import zip
 
 from util.config import Config, initialize_globals
@@ -80,6 +81,9 @@ def evaluate(test_csvs, create_model, try_loading):
     except NotImplementedError:
         num_processes = 1
 
+    # Decoding threads, kept for all test sets
+    decoder = DecoderPool(num_processes)
+
     # Create a saver using variables from the above newly created graph
     saver = tfv1.train.Saver()
 
@@ -106,6 +110,20 @@ def evaluate(test_csvs, create_model, try_loading):
 
             step_count = 0
 
+            # Predictions of the batches being decoded, None until decoded
+            pending = collections.OrderedDict()
+
+            def collect_batch():
+                # Wait for the oldest batch being decoded to be complete
+                batch, batch_predictions = pending.popitem(last=False)
+                while None in batch_predictions:
+                    decoded_batch, index, decoded = decoder.next()
+                    if decoded_batch == batch:
+                        batch_predictions[index] = decoded[0][1]
+                    else:
+                        pending[decoded_batch][index] = decoded[0][1]
+                predictions.extend(batch_predictions)
+
             # Initialize iterator to the appropriate dataset
             session.run(init_op)
 
@@ -117,10 +135,15 @@ def evaluate(test_csvs, create_model, try_loading):
                 except tf.errors.OutOfRangeError:
                     break
 
-                decoded = ctc_beam_search_decoder_batch(batch_logits, batch_lengths, Config.alphabet, FLAGS.beam_width,
-                                                        num_processes=num_processes, scorer=scorer,
-                                                        cutoff_prob=FLAGS.cutoff_prob, cutoff_top_n=FLAGS.cutoff_top_n)
-                predictions.extend(d[0][1] for d in decoded)
+                batch = decoder.submit(batch_logits, batch_lengths, Config.alphabet, FLAGS.beam_width,
+                                       scorer=scorer, cutoff_prob=FLAGS.cutoff_prob,
+                                       cutoff_top_n=FLAGS.cutoff_top_n,
+                                       blank_skip_threshold=FLAGS.blank_skip_threshold)
+                pending[batch] = [None] * len(batch_lengths)
+                # Decode the previous batch while the acoustic model runs on
+                # the next one
+                if len(pending) > 1:
+                    collect_batch()
                 ground_truths.extend(sparse_tensor_value_to_texts(batch_transcripts, Config.alphabet))
                 wav_filenames.extend(wav_filename.decode('UTF-8') for wav_filename in batch_wav_filenames)
                 losses.extend(batch_loss)
@@ -128,6 +151,9 @@ def evaluate(test_csvs, create_model, try_loading):
                 step_count += 1
                 bar.update(step_count)
 
+            while pending:
+                collect_batch()
+
             bar.finish()
 
             wer, cer, samples = calculate_report(wav_filenames, ground_truths, predictions, losses)
@@ -0,0 +1,137 @@
+#include "batchscheduler.h"
+
+#include <algorithm>
+
+#include "modelstate.h"
+
+using std::vector;
+
+BatchScheduler::BatchScheduler(ModelState* model,
+                               unsigned int max_batch_size,
+                               unsigned int max_wait_us)
+  : model_(model)
+  , max_batch_size_(max_batch_size)
+  , max_wait_(max_wait_us)
+  , stop_(false)
+{
+  worker_ = std::thread(&BatchScheduler::run, this);
+}
+
+BatchScheduler::~BatchScheduler()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  pending_cv_.notify_all();
+  worker_.join();
+}
+
+void
+BatchScheduler::infer(const vector<float>& mfcc,
+                      unsigned int n_frames,
+                      vector<float>& state_c,
+                      vector<float>& state_h,
+                      vector<float>& logits_output)
+{
+  Request request;
+  request.mfcc = &mfcc;
+  request.n_frames = n_frames;
+  request.state_c = &state_c;
+  request.state_h = &state_h;
+  request.logits = &logits_output;
+  request.enqueued = std::chrono::steady_clock::now();
+  request.done = false;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  pending_.push_back(&request);
+  pending_cv_.notify_one();
+  done_cv_.wait(lock, [&request] { return request.done; });
+}
+
+void
+BatchScheduler::run()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    pending_cv_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+    if (pending_.empty()) {
+      // Only reachable when stopping
+      return;
+    }
+
+    // Give other streams a chance to fill the batch, up to the deadline of the
+    // oldest pending step
+    auto deadline = pending_.front()->enqueued + max_wait_;
+    pending_cv_.wait_until(lock, deadline, [this] {
+      return stop_ || pending_.size() >= max_batch_size_;
+    });
+
+    vector<Request*> batch;
+    while (!pending_.empty() && batch.size() < max_batch_size_) {
+      batch.push_back(pending_.front());
+      pending_.pop_front();
+    }
+
+    lock.unlock();
+    process(batch);
+    lock.lock();
+
+    for (Request* request : batch) {
+      request->done = true;
+    }
+    done_cv_.notify_all();
+  }
+}
+
+void
+BatchScheduler::process(const vector<Request*>& batch)
+{
+  const size_t num_classes = model_->alphabet_.GetSize() + 1; // +1 for blank
+  const size_t step_size = model_->n_steps_ * model_->mfcc_feats_per_timestep_;
+  const size_t logits_size = model_->n_steps_ * num_classes;
+  const size_t state_size = model_->state_size_;
+
+  // Gather: each sequence occupies a full, zero-padded step in the batch
+  vector<float> mfcc(batch.size() * step_size, 0.f);
+  vector<unsigned int> n_frames;
+  vector<float> state_c;
+  vector<float> state_h;
+  n_frames.reserve(batch.size());
+  state_c.reserve(batch.size() * state_size);
+  state_h.reserve(batch.size() * state_size);
+
+  for (size_t i = 0; i < batch.size(); ++i) {
+    const Request* request = batch[i];
+    std::copy_n(request->mfcc->begin(),
+                std::min(request->mfcc->size(), step_size),
+                mfcc.begin() + i * step_size);
+    n_frames.push_back(request->n_frames);
+    state_c.insert(state_c.end(), request->state_c->begin(), request->state_c->end());
+    state_h.insert(state_h.end(), request->state_h->begin(), request->state_h->end());
+  }
+
+  vector<float> logits;
+  vector<float> new_state_c;
+  vector<float> new_state_h;
+  model_->infer(mfcc, model_->n_steps_, n_frames, state_c, state_h, logits, new_state_c, new_state_h);
+
+  if (logits.size() < batch.size() * logits_size) {
+    // Inference failed, error has already been reported by the model
+    for (Request* request : batch) {
+      request->logits->clear();
+    }
+    return;
+  }
+
+  // Scatter results back to each stream
+  for (size_t i = 0; i < batch.size(); ++i) {
+    Request* request = batch[i];
+    auto logits_begin = logits.begin() + i * logits_size;
+    request->logits->assign(logits_begin, logits_begin + request->n_frames * num_classes);
+    auto state_c_begin = new_state_c.begin() + i * state_size;
+    request->state_c->assign(state_c_begin, state_c_begin + state_size);
+    auto state_h_begin = new_state_h.begin() + i * state_size;
+    request->state_h->assign(state_h_begin, state_h_begin + state_size);
+  }
+}
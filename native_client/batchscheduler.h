@@ -0,0 +1,79 @@
+#ifndef BATCHSCHEDULER_H
+#define BATCHSCHEDULER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct ModelState;
+
+/* Dynamic batching of acoustic model steps across streams.
+
+   Every StreamingState sharing a ModelState submits its ready batch of n_steps
+   timesteps, along with its LSTM state, to the scheduler and blocks. A worker
+   thread packs up to max_batch_size pending steps from different streams into
+   a single call to ModelState::infer, then scatters the logits and new LSTM
+   states back to each stream and wakes it up.
+
+   A batch is dispatched as soon as it is full, or when the oldest pending step
+   has waited for max_wait, whichever comes first.
+*/
+class BatchScheduler {
+public:
+  BatchScheduler(ModelState* model,
+                 unsigned int max_batch_size,
+                 unsigned int max_wait_us);
+  ~BatchScheduler();
+
+  // Disallow copying
+  BatchScheduler(const BatchScheduler&) = delete;
+  BatchScheduler& operator=(const BatchScheduler&) = delete;
+
+  /**
+   * @brief Run one acoustic model step for a single stream as part of the
+   *        next batch. Blocks until the batch containing it has been computed.
+   *
+   * @param mfcc Input features for the step, at most
+   *             n_steps_*mfcc_feats_per_timestep_ values.
+   * @param n_frames Number of timesteps in @p mfcc.
+   * @param[in,out] state_c LSTM cell state of the stream, updated in place.
+   * @param[in,out] state_h LSTM hidden state of the stream, updated in place.
+   * @param[out] logits_output Where to store the n_frames computed logits.
+   */
+  void infer(const std::vector<float>& mfcc,
+             unsigned int n_frames,
+             std::vector<float>& state_c,
+             std::vector<float>& state_h,
+             std::vector<float>& logits_output);
+
+private:
+  struct Request {
+    const std::vector<float>* mfcc;
+    unsigned int n_frames;
+    std::vector<float>* state_c;
+    std::vector<float>* state_h;
+    std::vector<float>* logits;
+    std::chrono::steady_clock::time_point enqueued;
+    bool done;
+  };
+
+  void run();
+  void process(const std::vector<Request*>& batch);
+
+  ModelState* model_; // weak
+  unsigned int max_batch_size_;
+  std::chrono::microseconds max_wait_;
+
+  std::mutex mutex_;
+  std::condition_variable pending_cv_;
+  std::condition_variable done_cv_;
+  std::deque<Request*> pending_;
+  bool stop_;
+
+  std::thread worker_;
+};
+
+#endif // BATCHSCHEDULER_H
@@ -0,0 +1,33 @@
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include "ctcdecode/scorer.h"
+#include "alphabet.h"
+
+using namespace std;
+
+int convert_trie(const char* alphabet_path, const char* kenlm_path, const char* old_trie_path, const char* trie_path) {
+  Alphabet alphabet;
+  int err = alphabet.init(alphabet_path);
+  if (err != 0) {
+    return err;
+  }
+  // Outdated trie files are upgraded when loaded
+  Scorer scorer;
+  scorer.dictionary_progress = &std::cerr;
+  err = scorer.init(0.0, 0.0, kenlm_path, old_trie_path, alphabet);
+  if (err != 0) {
+    return err;
+  }
+  return scorer.save_dictionary(trie_path);
+}
+
+int main(int argc, char** argv) {
+  if (argc != 5) {
+    std::cerr << "Usage: " << argv[0] << " <alphabet> <lm_model> <old_trie_path> <trie_path>" << std::endl;
+    return -1;
+  }
+
+  return convert_trie(argv[1], argv[2], argv[3], argv[4]);
+}
@@ -32,12 +32,19 @@ class Scorer(swigwrapper.Scorer):
             raise ValueError("Scorer initialization failed with error code {}".format(err), err)
 
 
+def _check_blank_skip_threshold(blank_skip_threshold):
+    if not 0.0 <= blank_skip_threshold <= 1.0:
+        raise ValueError("Blank skip threshold must be between 0 and 1, got {}.".format(blank_skip_threshold))
+
+
 def ctc_beam_search_decoder(probs_seq,
                             alphabet,
                             beam_size,
                             cutoff_prob=1.0,
                             cutoff_top_n=40,
-                            scorer=None):
+                            scorer=None,
+                            blank_skip_threshold=1.0,
+                            num_threads=1):
     """Wrapper for the CTC Beam Search Decoder.
 
     :param probs_seq: 2-D list of probability distributions over each time
@@ -57,10 +64,19 @@ def ctc_beam_search_decoder(probs_seq,
     :param scorer: External scorer for partially decoded sentence, e.g. word
                    count or language model.
     :type scorer: Scorer
+    :param blank_skip_threshold: Blank probability above which a time step
+                                 only updates the beam without extending it,
+                                 between 0 and 1, default 1.0, no skipping.
+                                 Raises ValueError outside of that range.
+    :type blank_skip_threshold: float
+    :param num_threads: Number of threads sharing the decoding, with the
+                        same result as a single one, default 1.
+    :type num_threads: int
     :return: List of tuples of confidence and sentence as decoding
              results, in descending order of the confidence.
     :rtype: list
     """
+    _check_blank_skip_threshold(blank_skip_threshold)
     serialized = alphabet.serialize()
     native_alphabet = swigwrapper.Alphabet()
     err = native_alphabet.deserialize(serialized, len(serialized))
@@ -68,7 +84,7 @@ def ctc_beam_search_decoder(probs_seq,
         raise ValueError("Error when deserializing alphabet.")
     beam_results = swigwrapper.ctc_beam_search_decoder(
         probs_seq, native_alphabet, beam_size, cutoff_prob, cutoff_top_n,
-        scorer)
+        scorer, blank_skip_threshold, num_threads)
     beam_results = [(res.confidence, alphabet.decode(res.tokens)) for res in beam_results]
     return beam_results
 
@@ -80,7 +96,8 @@ def ctc_beam_search_decoder_batch(probs_seq,
                                   num_processes,
                                   cutoff_prob=1.0,
                                   cutoff_top_n=40,
-                                  scorer=None):
+                                  scorer=None,
+                                  blank_skip_threshold=1.0):
     """Wrapper for the batched CTC beam search decoder.
 
     :param probs_seq: 3-D list with each element as an instance of 2-D list
@@ -104,18 +121,94 @@ def ctc_beam_search_decoder_batch(probs_seq,
     :param scorer: External scorer for partially decoded sentence, e.g. word
                    count or language model.
     :type scorer: Scorer
+    :param blank_skip_threshold: Blank probability above which a time step
+                                 only updates the beam without extending it,
+                                 between 0 and 1, default 1.0, no skipping.
+                                 Raises ValueError outside of that range.
+    :type blank_skip_threshold: float
     :return: List of tuples of confidence and sentence as decoding
              results, in descending order of the confidence.
     :rtype: list
     """
+    _check_blank_skip_threshold(blank_skip_threshold)
     serialized = alphabet.serialize()
     native_alphabet = swigwrapper.Alphabet()
     err = native_alphabet.deserialize(serialized, len(serialized))
     if err != 0:
         raise ValueError("Error when deserializing alphabet.")
-    batch_beam_results = swigwrapper.ctc_beam_search_decoder_batch(probs_seq, seq_lengths, native_alphabet, beam_size, num_processes, cutoff_prob, cutoff_top_n, scorer)
+    batch_beam_results = swigwrapper.ctc_beam_search_decoder_batch(probs_seq, seq_lengths, native_alphabet, beam_size, num_processes, cutoff_prob, cutoff_top_n, scorer, blank_skip_threshold)
     batch_beam_results = [
         [(res.confidence, alphabet.decode(res.tokens)) for res in beam_results]
         for beam_results in batch_beam_results
     ]
     return batch_beam_results
+
+
+class DecoderPool(swigwrapper.DecoderPool):
+    """Wrapper for DecoderPool, threads decoding batches of utterances that
+    are kept alive from one batch to the next. The utterances of a batch are
+    decoded longest first, and returned as soon as they are decoded.
+
+    :param num_threads: Number of decoding threads.
+    :type num_threads: int
+    """
+
+    def __init__(self, num_threads):
+        super(DecoderPool, self).__init__(num_threads)
+        # Alphabet and scorer of each batch still decoding, which must be
+        # kept alive until then
+        self._batches = {}
+
+    def submit(self,
+               probs_seq,
+               seq_lengths,
+               alphabet,
+               beam_size,
+               cutoff_prob=1.0,
+               cutoff_top_n=40,
+               scorer=None,
+               blank_skip_threshold=1.0):
+        """Queue a batch for decoding, after the batches submitted before it.
+
+        The parameters are those of ctc_beam_search_decoder_batch(), but for
+        num_processes.
+
+        :return: Number of the batch.
+        :rtype: int
+        """
+        _check_blank_skip_threshold(blank_skip_threshold)
+        serialized = alphabet.serialize()
+        native_alphabet = swigwrapper.Alphabet()
+        err = native_alphabet.deserialize(serialized, len(serialized))
+        if err != 0:
+            raise ValueError("Error when deserializing alphabet.")
+        batch = super(DecoderPool, self).submit(probs_seq, seq_lengths, native_alphabet, beam_size,
+                                                cutoff_prob, cutoff_top_n, scorer, blank_skip_threshold)
+        if len(seq_lengths) > 0:
+            self._batches[batch] = [alphabet, scorer, len(seq_lengths)]
+        return batch
+
+    def next(self):
+        """Wait for the next utterance to be decoded, in order of completion.
+
+        :return: Tuple of the batch number, the index of the utterance in the
+                 batch, and its results as ctc_beam_search_decoder() returns
+                 them. None when no utterance is left to decode.
+        :rtype: tuple
+        """
+        utterance = super(DecoderPool, self).next()
+        if utterance.index < 0:
+            return None
+        batch = self._batches[utterance.batch]
+        beam_results = [(res.confidence, batch[0].decode(res.tokens)) for res in utterance.outputs]
+        batch[2] -= 1
+        if batch[2] == 0:
+            del self._batches[utterance.batch]
+        return utterance.batch, utterance.index, beam_results
+
+    def as_completed(self):
+        """Generate the results of next() until no utterance is left to decode."""
+        result = self.next()
+        while result is not None:
+            yield result
+            result = self.next()
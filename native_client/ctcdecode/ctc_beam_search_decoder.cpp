@@ -1,24 +1,32 @@
 #include "ctc_beam_search_decoder.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <iostream>
 #include <limits>
 #include <map>
 #include <utility>
 
+#include "decoder_pool.h"
 #include "decoder_utils.h"
-#include "ThreadPool.h"
 #include "fst/fstlib.h"
 #include "path_trie.h"
 
 
+DecoderState::DecoderState()
+  : node_allocator_(sizeof(PathTrie))
+{
+}
+
 int
 DecoderState::init(const Alphabet& alphabet,
                    size_t beam_size,
                    double cutoff_prob,
                    size_t cutoff_top_n,
-                   Scorer *ext_scorer)
+                   Scorer *ext_scorer,
+                   double blank_skip_threshold,
+                   size_t num_threads)
 {
   // assign special ids
   abs_time_step_ = 0;
@@ -28,25 +36,57 @@ DecoderState::init(const Alphabet& alphabet,
   beam_size_ = beam_size;
   cutoff_prob_ = cutoff_prob;
   cutoff_top_n_ = cutoff_top_n;
+  blank_skip_threshold_ = blank_skip_threshold;
+  num_threads_ = std::max(num_threads, size_t(1));
   ext_scorer_ = ext_scorer;
+  shared_ = std::make_shared<Shared>();
 
   // init prefixes' root
-  PathTrie *root = new PathTrie;
+  PathTrie *root = PathTrie::create_root(node_allocator_);
   root->score = root->log_prob_b_prev = 0.0;
   prefix_root_.reset(root);
   prefixes_.push_back(root);
 
+  // allocators are only added, as nodes of an earlier trie may be left
+  while (worker_allocators_.size() + 1 < num_threads_) {
+    worker_allocators_.emplace_back(new PathTrieAllocator(sizeof(PathTrie)));
+  }
+  shared_->worker_caches.resize(num_threads_ - 1);
+
   if (ext_scorer != nullptr) {
-    // no need for std::make_shared<>() since Copy() does 'new' behind the doors
-    auto dict_ptr = std::shared_ptr<PathTrie::FstType>(ext_scorer->dictionary->Copy(true));
-    root->set_dictionary(dict_ptr);
-    auto matcher = std::make_shared<fst::SortedMatcher<PathTrie::FstType>>(*dict_ptr, fst::MATCH_INPUT);
-    root->set_matcher(matcher);
+    // spelling correction, the dictionary is shared by all decoder states
+    root->set_dictionary(ext_scorer->dictionary.get());
   }
 
   return 0;
 }
 
+DecoderState::DecoderState(const DecoderState& other)
+  : abs_time_step_(other.abs_time_step_)
+  , space_id_(other.space_id_)
+  , blank_id_(other.blank_id_)
+  , beam_size_(other.beam_size_)
+  , cutoff_prob_(other.cutoff_prob_)
+  , cutoff_top_n_(other.cutoff_top_n_)
+  , blank_skip_threshold_(other.blank_skip_threshold_)
+  , num_threads_(other.num_threads_)
+  , ext_scorer_(other.ext_scorer_)
+  , node_allocator_(sizeof(PathTrie))
+  , shared_(other.shared_)
+{
+  for (size_t i = 0; i < other.worker_allocators_.size(); ++i) {
+    worker_allocators_.emplace_back(new PathTrieAllocator(sizeof(PathTrie)));
+  }
+
+  std::unordered_map<const PathTrie*, PathTrie*> mapping;
+  prefix_root_.reset(other.prefix_root_->clone(nullptr, node_allocator_, mapping));
+
+  prefixes_.reserve(other.prefixes_.size());
+  for (PathTrie* prefix : other.prefixes_) {
+    prefixes_.push_back(mapping[prefix]);
+  }
+}
+
 void
 DecoderState::next(const double *probs,
                    int time_dim,
@@ -56,10 +96,15 @@ DecoderState::next(const double *probs,
   for (size_t rel_time_step = 0; rel_time_step < time_dim; ++rel_time_step, ++abs_time_step_) {
     auto *prob = &probs[rel_time_step*class_dim];
 
+    if (prob[blank_id_] > blank_skip_threshold_) {
+      next_blank_step(prob);
+      continue;
+    }
+
+    size_t num_prefixes = std::min(prefixes_.size(), beam_size_);
     float min_cutoff = -NUM_FLT_INF;
     bool full_beam = false;
     if (ext_scorer_ != nullptr) {
-      size_t num_prefixes = std::min(prefixes_.size(), beam_size_);
       std::partial_sort(prefixes_.begin(),
                         prefixes_.begin() + num_prefixes,
                         prefixes_.end(),
@@ -70,75 +115,103 @@ DecoderState::next(const double *probs,
       full_beam = (num_prefixes == beam_size_);
     }
 
-    std::vector<std::pair<size_t, float>> log_prob_idx =
-        get_pruned_log_probs(prob, class_dim, cutoff_prob_, cutoff_top_n_);
-    // loop over class dim
-    for (size_t index = 0; index < log_prob_idx.size(); index++) {
-      auto c = log_prob_idx[index].first;
-      auto log_prob_c = log_prob_idx[index].second;
-
-      for (size_t i = 0; i < prefixes_.size() && i < beam_size_; ++i) {
-        auto prefix = prefixes_[i];
-        if (full_beam && log_prob_c + prefix->score < min_cutoff) {
-          break;
-        }
-
-        // blank
-        if (c == blank_id_) {
-          prefix->log_prob_b_cur =
-              log_sum_exp(prefix->log_prob_b_cur, log_prob_c + prefix->score);
-          continue;
-        }
+    get_pruned_log_probs(prob, class_dim, cutoff_prob_, cutoff_top_n_,
+                         prob_idx_, log_prob_idx_);
+    if (num_threads_ > 1 && num_prefixes >= MIN_PARALLEL_SIZE) {
+      extend_parallel(num_prefixes, full_beam, min_cutoff);
+    } else {
+      // loop over class dim
+      for (size_t index = 0; index < log_prob_idx_.size(); index++) {
+        auto c = log_prob_idx_[index].first;
+        auto log_prob_c = log_prob_idx_[index].second;
+
+        for (size_t i = 0; i < prefixes_.size() && i < beam_size_; ++i) {
+          auto prefix = prefixes_[i];
+          if (full_beam && log_prob_c + prefix->score < min_cutoff) {
+            break;
+          }
 
-        // repeated character
-        if (c == prefix->character) {
-          prefix->log_prob_nb_cur = log_sum_exp(
-              prefix->log_prob_nb_cur, log_prob_c + prefix->log_prob_nb_prev);
-        }
+          // blank
+          if (c == blank_id_) {
+            prefix->log_prob_b_cur =
+                log_sum_exp(prefix->log_prob_b_cur, log_prob_c + prefix->score);
+            continue;
+          }
 
-        // get new prefix
-        auto prefix_new = prefix->get_path_trie(c, abs_time_step_, log_prob_c);
+          // repeated character
+          if (c == prefix->character) {
+            prefix->log_prob_nb_cur = log_sum_exp(
+                prefix->log_prob_nb_cur, log_prob_c + prefix->log_prob_nb_prev);
+          }
 
-        if (prefix_new != nullptr) {
-          float log_p = -NUM_FLT_INF;
+          // get new prefix
+          auto prefix_new = prefix->get_path_trie(c, abs_time_step_, log_prob_c, new_prefixes_);
 
-          if (c == prefix->character &&
-              prefix->log_prob_b_prev > -NUM_FLT_INF) {
-            log_p = log_prob_c + prefix->log_prob_b_prev;
-          } else if (c != prefix->character) {
-            log_p = log_prob_c + prefix->score;
-          }
+          if (prefix_new != nullptr) {
+            float log_p = -NUM_FLT_INF;
 
-          if (ext_scorer_ != nullptr) {
-            // skip scoring the space in word based LMs
-            PathTrie* prefix_to_score;
-            if (ext_scorer_->is_utf8_mode()) {
-              prefix_to_score = prefix_new;
-            } else {
-              prefix_to_score = prefix;
+            if (c == prefix->character &&
+                prefix->log_prob_b_prev > -NUM_FLT_INF) {
+              log_p = log_prob_c + prefix->log_prob_b_prev;
+            } else if (c != prefix->character) {
+              log_p = log_prob_c + prefix->score;
             }
 
-            // language model scoring
-            if (ext_scorer_->is_scoring_boundary(prefix_to_score, c)) {
-              float score = 0.0;
-              std::vector<std::string> ngram;
-              ngram = ext_scorer_->make_ngram(prefix_to_score);
-              bool bos = ngram.size() < ext_scorer_->get_max_order();
-              score = ext_scorer_->get_log_cond_prob(ngram, bos) * ext_scorer_->alpha;
-              log_p += score;
-              log_p += ext_scorer_->beta;
+            if (ext_scorer_ != nullptr) {
+              // skip scoring the space in word based LMs
+              PathTrie* prefix_to_score;
+              if (ext_scorer_->is_utf8_mode()) {
+                prefix_to_score = prefix_new;
+              } else {
+                prefix_to_score = prefix;
+              }
+
+              // language model scoring, done for all boundaries of this time
+              // step at once below
+              if (ext_scorer_->is_scoring_boundary(prefix_to_score, c)) {
+                lm_queries_.emplace_back(prefix_to_score, prefix_new);
+                lm_query_log_probs_.push_back(log_p);
+                continue;
+              }
             }
+
+            prefix_new->log_prob_nb_cur =
+                log_sum_exp(prefix_new->log_prob_nb_cur, log_p);
           }
+        }  // end of loop over prefix
+      }    // end of loop over alphabet
+    }
 
-          prefix_new->log_prob_nb_cur =
-              log_sum_exp(prefix_new->log_prob_nb_cur, log_p);
-        }
-      }  // end of loop over prefix
-    }    // end of loop over alphabet
+    // Apply the language model to the prefixes that reached a scoring
+    // boundary. Each of them only gets log probs from its parent, added above,
+    // and from itself on repeated characters, which commutes with this.
+    if (!lm_queries_.empty()) {
+      if (num_threads_ > 1 && lm_queries_.size() >= MIN_PARALLEL_SIZE) {
+        score_parallel();
+      } else {
+        ext_scorer_->score_prefixes(lm_queries_, &shared_->lm_cache);
+      }
+      for (size_t i = 0; i < lm_queries_.size(); ++i) {
+        PathTrie* prefix_new = lm_queries_[i].second;
+        float log_p = lm_query_log_probs_[i];
+        float score = 0.0;
+        score = ext_scorer_->get_prefix_log_cond_prob(lm_queries_[i].first, prefix_new, &shared_->lm_cache) * ext_scorer_->alpha;
+        log_p += score;
+        log_p += ext_scorer_->beta;
+        prefix_new->log_prob_nb_cur =
+            log_sum_exp(prefix_new->log_prob_nb_cur, log_p);
+      }
+      lm_queries_.clear();
+      lm_query_log_probs_.clear();
+    }
 
-    // update log probs
-    prefixes_.clear();
-    prefix_root_->iterate_to_vec(prefixes_);
+    // update log probs of the candidates: the current beam and the prefixes
+    // it was extended to
+    prefixes_.insert(prefixes_.end(), new_prefixes_.begin(), new_prefixes_.end());
+    new_prefixes_.clear();
+    for (PathTrie* prefix : prefixes_) {
+      prefix->advance();
+    }
 
     // only preserve top beam_size prefixes
     if (prefixes_.size() > beam_size_) {
@@ -156,6 +229,213 @@ DecoderState::next(const double *probs,
   }  // end of loop over time
 }
 
+WorkerGroup&
+DecoderState::workers()
+{
+  if (shared_->workers == nullptr) {
+    shared_->workers.reset(new WorkerGroup(num_threads_));
+  }
+  return *shared_->workers;
+}
+
+void
+DecoderState::extend_parallel(size_t num_prefixes, bool full_beam, float min_cutoff)
+{
+  // Workers take chunks of consecutive prefixes as they go, so that the
+  // prefixes cut short by min_cutoff don't leave some of them idle
+  const size_t num_chunks = std::min(num_prefixes, num_threads_ * 4);
+  const size_t chunk_size = (num_prefixes + num_chunks - 1) / num_chunks;
+  if (chunks_.size() < num_chunks) {
+    chunks_.resize(num_chunks);
+  }
+  std::atomic<size_t> next_chunk(0);
+  workers().run([&](size_t worker) {
+    PathTrieAllocator* allocator = worker == 0 ? &node_allocator_ : worker_allocators_[worker - 1].get();
+    for (size_t i = next_chunk++; i < num_chunks; i = next_chunk++) {
+      size_t begin = i * chunk_size;
+      size_t end = std::min(begin + chunk_size, num_prefixes);
+      extend_chunk(chunks_[i], begin, end, full_beam, min_cutoff, allocator);
+    }
+  });
+
+  // Gather the new prefixes and language model queries in the order the
+  // serial loop finds them, which the pruning of the beam depends on
+  for (size_t index = 0; index < log_prob_idx_.size(); index++) {
+    for (size_t i = 0; i < num_chunks; ++i) {
+      const ExtensionChunk& chunk = chunks_[i];
+      size_t begin = index == 0 ? 0 : chunk.new_prefix_ends[index - 1];
+      new_prefixes_.insert(new_prefixes_.end(),
+                           chunk.new_prefixes.begin() + begin,
+                           chunk.new_prefixes.begin() + chunk.new_prefix_ends[index]);
+      begin = index == 0 ? 0 : chunk.lm_query_ends[index - 1];
+      lm_queries_.insert(lm_queries_.end(),
+                         chunk.lm_queries.begin() + begin,
+                         chunk.lm_queries.begin() + chunk.lm_query_ends[index]);
+      lm_query_log_probs_.insert(lm_query_log_probs_.end(),
+                                 chunk.lm_query_log_probs.begin() + begin,
+                                 chunk.lm_query_log_probs.begin() + chunk.lm_query_ends[index]);
+    }
+  }
+
+  // Then extend the beam to its own prefixes, now that no worker is using
+  // them
+  for (size_t i = 0; i < num_chunks; ++i) {
+    for (const ExtensionChunk::BeamExtension& extension : chunks_[i].beam_extensions) {
+      PathTrie* prefix_new = extension.prefix_new;
+      if (prefix_new->log_prob_c < extension.log_prob_c &&
+          prefix_new->is_leaf_before(abs_time_step_)) {
+        prefix_new->log_prob_c = extension.log_prob_c;
+        prefix_new->timestep = abs_time_step_;
+      }
+      // a prefix gets at most one extension, besides its repeated character
+      if (extension.add_log_p) {
+        prefix_new->log_prob_nb_cur =
+            log_sum_exp(prefix_new->log_prob_nb_cur, extension.log_p);
+      }
+    }
+  }
+}
+
+void
+DecoderState::extend_chunk(ExtensionChunk& chunk,
+                           size_t begin,
+                           size_t end,
+                           bool full_beam,
+                           float min_cutoff,
+                           PathTrieAllocator* allocator)
+{
+  chunk.new_prefixes.clear();
+  chunk.new_prefix_ends.clear();
+  chunk.lm_queries.clear();
+  chunk.lm_query_log_probs.clear();
+  chunk.lm_query_ends.clear();
+  chunk.beam_extensions.clear();
+
+  // same as the serial loop, but for the prefixes of the beam it extends to
+  for (size_t index = 0; index < log_prob_idx_.size(); index++) {
+    auto c = log_prob_idx_[index].first;
+    auto log_prob_c = log_prob_idx_[index].second;
+
+    for (size_t i = begin; i < end; ++i) {
+      auto prefix = prefixes_[i];
+      if (full_beam && log_prob_c + prefix->score < min_cutoff) {
+        break;
+      }
+
+      // blank
+      if (c == blank_id_) {
+        prefix->log_prob_b_cur =
+            log_sum_exp(prefix->log_prob_b_cur, log_prob_c + prefix->score);
+        continue;
+      }
+
+      // repeated character
+      if (c == prefix->character) {
+        prefix->log_prob_nb_cur = log_sum_exp(
+            prefix->log_prob_nb_cur, log_prob_c + prefix->log_prob_nb_prev);
+      }
+
+      // get new prefix, leaving those of the beam alone
+      auto prefix_new = prefix->get_existing_child(c);
+      const bool in_beam = prefix_new != nullptr;
+      if (!in_beam) {
+        prefix_new = prefix->get_path_trie(c, abs_time_step_, log_prob_c, chunk.new_prefixes, true, allocator);
+      }
+
+      if (prefix_new != nullptr) {
+        float log_p = -NUM_FLT_INF;
+
+        if (c == prefix->character &&
+            prefix->log_prob_b_prev > -NUM_FLT_INF) {
+          log_p = log_prob_c + prefix->log_prob_b_prev;
+        } else if (c != prefix->character) {
+          log_p = log_prob_c + prefix->score;
+        }
+
+        bool add_log_p = true;
+        if (ext_scorer_ != nullptr) {
+          // skip scoring the space in word based LMs
+          PathTrie* prefix_to_score;
+          if (ext_scorer_->is_utf8_mode()) {
+            prefix_to_score = prefix_new;
+          } else {
+            prefix_to_score = prefix;
+          }
+
+          if (ext_scorer_->is_scoring_boundary(prefix_to_score, c)) {
+            chunk.lm_queries.emplace_back(prefix_to_score, prefix_new);
+            chunk.lm_query_log_probs.push_back(log_p);
+            add_log_p = false;
+          }
+        }
+
+        if (in_beam) {
+          chunk.beam_extensions.push_back(
+            ExtensionChunk::BeamExtension{prefix_new, log_prob_c, log_p, add_log_p});
+        } else if (add_log_p) {
+          prefix_new->log_prob_nb_cur =
+              log_sum_exp(prefix_new->log_prob_nb_cur, log_p);
+        }
+      }
+    }
+    chunk.new_prefix_ends.push_back(chunk.new_prefixes.size());
+    chunk.lm_query_ends.push_back(chunk.lm_queries.size());
+  }
+}
+
+void
+DecoderState::score_parallel()
+{
+  // Units scored from units of this time step are scored first, with the
+  // lookups of the others. Boundaries of a time step are distinct.
+  ext_scorer_->find_prev_units(lm_queries_, &previous_units_, &shared_->lm_cache);
+
+  const size_t share = (lm_queries_.size() + num_threads_ - 1) / num_threads_;
+  workers().run([&](size_t worker) {
+    ScoreCache* cache = worker == 0 ? &shared_->lm_cache : &shared_->worker_caches[worker - 1];
+    size_t begin = std::min(worker * share, lm_queries_.size());
+    size_t end = std::min(begin + share, lm_queries_.size());
+    ext_scorer_->score_units(lm_queries_, previous_units_, begin, end, cache);
+  });
+}
+
+void
+DecoderState::next_blank_step(const double *prob)
+{
+  // Prefixes other than those in the beam can only gain probability from
+  // the few non-blank classes, so they are not created. The beam keeps the
+  // same prefixes and needs no pruning.
+  float log_prob_blank = std::log(prob[blank_id_] + NUM_FLT_MIN);
+  for (PathTrie* prefix : prefixes_) {
+    prefix->log_prob_b_cur = log_prob_blank + prefix->score;
+    if (!prefix->is_empty()) {
+      float log_prob_c = std::log(prob[prefix->character] + NUM_FLT_MIN);
+      prefix->log_prob_nb_cur = log_prob_c + prefix->log_prob_nb_prev;
+    }
+    prefix->advance();
+  }
+}
+
+size_t
+DecoderState::lm_cache_hits() const
+{
+  size_t hits = shared_->lm_cache.hits();
+  for (const ScoreCache& cache : shared_->worker_caches) {
+    hits += cache.hits();
+  }
+  return hits;
+}
+
+size_t
+DecoderState::lm_cache_misses() const
+{
+  size_t misses = shared_->lm_cache.misses();
+  for (const ScoreCache& cache : shared_->worker_caches) {
+    misses += cache.misses();
+  }
+  return misses;
+}
+
 std::vector<Output>
 DecoderState::decode() const
 {
@@ -171,21 +451,22 @@ DecoderState::decode() const
       auto prefix = prefixes_copy[i];
       if (!ext_scorer_->is_scoring_boundary(prefix->parent, prefix->character)) {
         float score = 0.0;
-        std::vector<std::string> ngram = ext_scorer_->make_ngram(prefix);
-        bool bos = ngram.size() < ext_scorer_->get_max_order();
-        score = ext_scorer_->get_log_cond_prob(ngram, bos) * ext_scorer_->alpha;
+        score = ext_scorer_->get_partial_unit_log_cond_prob(prefix, &shared_->lm_cache) * ext_scorer_->alpha;
         score += ext_scorer_->beta;
         scores[prefix] += score;
       }
     }
   }
 
-  using namespace std::placeholders;
+  // The comparison refers to scores, which std::bind would copy along with
+  // every copy of the comparison the sort makes
   size_t num_prefixes = std::min(prefixes_copy.size(), beam_size_);
   std::partial_sort(prefixes_copy.begin(),
                     prefixes_copy.begin() + num_prefixes,
                     prefixes_copy.end(),
-                    std::bind(prefix_compare_external, _1, _2, scores));
+                    [&scores](const PathTrie* x, const PathTrie* y) {
+                      return prefix_compare_external(x, y, scores);
+                    });
 
   //TODO: expose this as an API parameter
   const size_t top_paths = 1;
@@ -222,10 +503,13 @@ std::vector<Output> ctc_beam_search_decoder(
     size_t beam_size,
     double cutoff_prob,
     size_t cutoff_top_n,
-    Scorer *ext_scorer)
+    Scorer *ext_scorer,
+    double blank_skip_threshold,
+    size_t num_threads)
 {
   DecoderState state;
-  state.init(alphabet, beam_size, cutoff_prob, cutoff_top_n, ext_scorer);
+  state.init(alphabet, beam_size, cutoff_prob, cutoff_top_n, ext_scorer, blank_skip_threshold,
+             num_threads);
   state.next(probs, time_dim, class_dim);
   return state.decode();
 }
@@ -243,31 +527,18 @@ ctc_beam_search_decoder_batch(
     size_t num_processes,
     double cutoff_prob,
     size_t cutoff_top_n,
-    Scorer *ext_scorer)
+    Scorer *ext_scorer,
+    double blank_skip_threshold)
 {
-  VALID_CHECK_GT(num_processes, 0, "num_processes must be nonnegative!");
-  VALID_CHECK_EQ(batch_size, seq_lengths_size, "must have one sequence length per batch element");
-  // thread pool
-  ThreadPool pool(num_processes);
-
-  // enqueue the tasks of decoding
-  std::vector<std::future<std::vector<Output>>> res;
-  for (size_t i = 0; i < batch_size; ++i) {
-    res.emplace_back(pool.enqueue(ctc_beam_search_decoder,
-                                  &probs[i*time_dim*class_dim],
-                                  seq_lengths[i],
-                                  class_dim,
-                                  alphabet,
-                                  beam_size,
-                                  cutoff_prob,
-                                  cutoff_top_n,
-                                  ext_scorer));
-  }
-
-  // get decoding results
-  std::vector<std::vector<Output>> batch_results;
-  for (size_t i = 0; i < batch_size; ++i) {
-    batch_results.emplace_back(res[i].get());
+  DecoderPool pool(num_processes);
+  pool.submit(probs, batch_size, time_dim, class_dim, seq_lengths, seq_lengths_size,
+              alphabet, beam_size, cutoff_prob, cutoff_top_n, ext_scorer,
+              blank_skip_threshold);
+
+  // get decoding results, as they complete
+  std::vector<std::vector<Output>> batch_results(batch_size);
+  for (DecodedUtterance utterance = pool.next(); utterance.index >= 0; utterance = pool.next()) {
+    batch_results[utterance.index] = std::move(utterance.outputs);
   }
   return batch_results;
 }
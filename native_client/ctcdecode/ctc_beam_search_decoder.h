@@ -1,12 +1,15 @@
 #ifndef CTC_BEAM_SEARCH_DECODER_H_
 #define CTC_BEAM_SEARCH_DECODER_H_
 
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "scorer.h"
 #include "output.h"
 #include "alphabet.h"
+#include "worker_group.h"
 
 class DecoderState {
   int abs_time_step_;
@@ -15,17 +18,106 @@ class DecoderState {
   size_t beam_size_;
   double cutoff_prob_;
   size_t cutoff_top_n_;
+  double blank_skip_threshold_;
+  size_t num_threads_;
 
   Scorer* ext_scorer_; // weak
+  // Pruned log probs of the current time step, and scratch space to compute
+  // them, kept to avoid allocating at every time step
+  std::vector<std::pair<size_t, double>> prob_idx_;
+  std::vector<std::pair<size_t, float>> log_prob_idx_;
+  // Prefixes in the beam. Together they are all the nodes of the trie that
+  // exist, which lets each time step only visit the beam and the prefixes
+  // it extends to, instead of the whole trie.
   std::vector<PathTrie*> prefixes_;
-  std::unique_ptr<PathTrie> prefix_root_;
+  // Prefixes that started to exist during the current time step
+  std::vector<PathTrie*> new_prefixes_;
+  // Language model queries of the current time step, as (prefix, boundary)
+  // pairs for Scorer::score_prefixes, with the log probs they will add to
+  std::vector<std::pair<PathTrie*, PathTrie*>> lm_queries_;
+  std::vector<float> lm_query_log_probs_;
+  // Must outlive the trie nodes it allocates
+  PathTrieAllocator node_allocator_;
+
+  // Prefixes extended by a worker during a time step, and what it found
+  // while extending them. The lists are in the order of the serial decoder,
+  // classes first, with the end of each class of log_prob_idx_ in *_ends.
+  struct ExtensionChunk {
+    std::vector<PathTrie*> new_prefixes;
+    std::vector<size_t> new_prefix_ends;
+    std::vector<std::pair<PathTrie*, PathTrie*>> lm_queries;
+    std::vector<float> lm_query_log_probs;
+    std::vector<size_t> lm_query_ends;
+    // Extensions to prefixes of the beam, left for after the workers are done
+    // as those prefixes are in the hands of other workers
+    struct BeamExtension {
+      PathTrie* prefix_new;
+      float log_prob_c;
+      // log prob added, when the language model does not score prefix_new
+      float log_p;
+      bool add_log_p;
+    };
+    std::vector<BeamExtension> beam_extensions;
+  };
+
+  // Language model queries of this stream, the first cache also used when
+  // decoding, and the workers sharing the time steps with num_threads_ > 1,
+  // created when first needed. Worker w > 0 allocates nodes with
+  // worker_allocators_[w - 1] and queries the language model through
+  // worker_caches[w - 1]. Copies of the state share all this instead of
+  // copying it.
+  struct Shared {
+    ScoreCache lm_cache;
+    std::vector<ScoreCache> worker_caches;
+    std::unique_ptr<WorkerGroup> workers;
+  };
+  std::shared_ptr<Shared> shared_;
+  std::vector<std::unique_ptr<PathTrieAllocator>> worker_allocators_;
+  std::vector<ExtensionChunk> chunks_;
+  std::vector<PathTrie*> previous_units_;
+
+  std::unique_ptr<PathTrie, PathTrie::Deleter> prefix_root_;
+
+  // Fewest prefixes, or language model queries, worth splitting between
+  // the workers
+  static constexpr size_t MIN_PARALLEL_SIZE = 64;
+
+  // Update the beam for a time step dominated by blank, following only the
+  // blank and the repetition of the last character of each prefix in it
+  void next_blank_step(const double *prob);
+
+  WorkerGroup& workers();
+
+  // Extend the first num_prefixes prefixes of the beam with the classes of
+  // log_prob_idx_, split between the workers, with the same result as the
+  // serial loop over them
+  void extend_parallel(size_t num_prefixes, bool full_beam, float min_cutoff);
+
+  // Extend the prefixes from begin to end for extend_parallel
+  void extend_chunk(ExtensionChunk& chunk,
+                    size_t begin,
+                    size_t end,
+                    bool full_beam,
+                    float min_cutoff,
+                    PathTrieAllocator* allocator);
+
+  // Score the language model queries of the time step, split between the
+  // workers
+  void score_parallel();
 
 public:
-  DecoderState() = default;
+  DecoderState();
   ~DecoderState() = default;
 
-  // Disallow copying
-  DecoderState(const DecoderState&) = delete;
+  /* Deep copy of another decoder state, including its prefix tree. The copy
+   * can be fed more data and decoded without affecting the original, which
+   * is useful to speculatively decode data that may later be superseded.
+   * The copy shares the language model caches and worker threads of the
+   * original, so they must not be used at the same time.
+  */
+  DecoderState(const DecoderState& other);
+
+  // Disallow assignment
   DecoderState& operator=(DecoderState&) = delete;
 
   /* Initialize CTC beam search decoder
@@ -38,6 +130,13 @@ public:
    *     ext_scorer: External scorer to evaluate a prefix, which consists of
    *                 n-gram language model scoring and word insertion term.
    *                 Default null, decoding the input sample without scorer.
+   *     blank_skip_threshold: Blank probability above which a time step only
+   *                           updates the probabilities of the prefixes in
+   *                           the beam, without extending them. Default 1.0,
+   *                           every time step extends the beam.
+   *     num_threads: Number of threads sharing the work of each time step,
+   *                  with the same result as a single one. Default 1, time
+   *                  steps are decoded by the calling thread alone.
    * Return:
    *     Zero on success, non-zero on failure.
   */
@@ -45,7 +144,9 @@ public:
            size_t beam_size,
            double cutoff_prob,
            size_t cutoff_top_n,
-           Scorer *ext_scorer);
+           Scorer *ext_scorer,
+           double blank_skip_threshold = 1.0,
+           size_t num_threads = 1);
 
   /* Send data to the decoder
    *
@@ -66,6 +167,11 @@ public:
    *     in descending order.
   */
   std::vector<Output> decode() const;
+
+  // Number of language model queries answered by the cache of this state,
+  // and of those that had to go to the language model
+  size_t lm_cache_hits() const;
+  size_t lm_cache_misses() const;
 };
 
 
@@ -82,6 +188,10 @@ public:
  *     ext_scorer: External scorer to evaluate a prefix, which consists of
  *                 n-gram language model scoring and word insertion term.
  *                 Default null, decoding the input sample without scorer.
+ *     blank_skip_threshold: Blank probability above which a time step does
+ *                           not extend the beam. Default 1.0, disabled.
+ *     num_threads: Number of threads decoding the sequence, with the same
+ *                  result as a single one. Default 1.
  * Return:
  *     A vector where each element is a pair of score and decoding result,
  *     in descending order.
@@ -95,9 +205,12 @@ std::vector<Output> ctc_beam_search_decoder(
     size_t beam_size,
     double cutoff_prob,
     size_t cutoff_top_n,
-    Scorer *ext_scorer);
+    Scorer *ext_scorer,
+    double blank_skip_threshold = 1.0,
+    size_t num_threads = 1);
 
-/* CTC Beam Search Decoder for batch data
+/* CTC Beam Search Decoder for batch data, decoding the longest utterances
+ * first. Use a DecoderPool to keep the threads from one batch to the next.
  * Parameters:
  *     probs: 3-D vector where each element is a 2-D vector that can be used
  *                by ctc_beam_search_decoder().
@@ -109,6 +222,8 @@ std::vector<Output> ctc_beam_search_decoder(
  *     ext_scorer: External scorer to evaluate a prefix, which consists of
  *                 n-gram language model scoring and word insertion term.
  *                 Default null, decoding the input sample without scorer.
+ *     blank_skip_threshold: Blank probability above which a time step does
+ *                           not extend the beam. Default 1.0, disabled.
  * Return:
  *     A 2-D vector where each element is a vector of beam search decoding
  *     result for one audio sample.
@@ -126,6 +241,7 @@ ctc_beam_search_decoder_batch(
     size_t num_processes,
     double cutoff_prob,
     size_t cutoff_top_n,
-    Scorer *ext_scorer);
+    Scorer *ext_scorer,
+    double blank_skip_threshold = 1.0);
 
 #endif  // CTC_BEAM_SEARCH_DECODER_H_
@@ -0,0 +1,125 @@
+#include "decoder_pool.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "ctc_beam_search_decoder.h"
+#include "decoder_utils.h"
+
+DecoderPool::DecoderPool(size_t num_threads)
+  : outstanding_(0)
+  , num_batches_(0)
+  , stop_(false)
+{
+  VALID_CHECK_GT(num_threads, 0, "num_threads must be positive!");
+  for (size_t i = 0; i < num_threads; ++i) {
+    workers_.emplace_back(&DecoderPool::run, this);
+  }
+}
+
+DecoderPool::~DecoderPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  pending_cv_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+int
+DecoderPool::submit(const double* probs,
+                    int batch_size,
+                    int time_dim,
+                    int class_dim,
+                    const int* seq_lengths,
+                    int seq_lengths_size,
+                    const Alphabet& alphabet,
+                    size_t beam_size,
+                    double cutoff_prob,
+                    size_t cutoff_top_n,
+                    Scorer* ext_scorer,
+                    double blank_skip_threshold)
+{
+  VALID_CHECK_EQ(batch_size, seq_lengths_size, "must have one sequence length per batch element");
+
+  std::shared_ptr<Batch> batch(new Batch());
+  batch->probs.assign(probs, probs + static_cast<size_t>(batch_size) * time_dim * class_dim);
+  batch->time_dim = time_dim;
+  batch->class_dim = class_dim;
+  batch->alphabet = alphabet;
+  batch->beam_size = beam_size;
+  batch->cutoff_prob = cutoff_prob;
+  batch->cutoff_top_n = cutoff_top_n;
+  batch->ext_scorer = ext_scorer;
+  batch->blank_skip_threshold = blank_skip_threshold;
+
+  std::vector<Job> jobs;
+  jobs.reserve(batch_size);
+  for (int i = 0; i < batch_size; ++i) {
+    jobs.push_back(Job{batch, i, seq_lengths[i]});
+  }
+  std::stable_sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) {
+    return a.length > b.length;
+  });
+
+  int number;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    number = batch->number = num_batches_++;
+    pending_.insert(pending_.end(), jobs.begin(), jobs.end());
+    outstanding_ += jobs.size();
+  }
+  pending_cv_.notify_all();
+  return number;
+}
+
+DecodedUtterance
+DecoderPool::next()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [this] { return !done_.empty() || outstanding_ == 0; });
+  if (done_.empty()) {
+    return DecodedUtterance();
+  }
+  DecodedUtterance utterance = std::move(done_.front());
+  done_.pop_front();
+  return utterance;
+}
+
+void
+DecoderPool::run()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    pending_cv_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+    if (stop_) {
+      return;
+    }
+    Job job = std::move(pending_.front());
+    pending_.pop_front();
+    lock.unlock();
+
+    const Batch& batch = *job.batch;
+    DecodedUtterance utterance;
+    utterance.batch = batch.number;
+    utterance.index = job.index;
+    utterance.outputs = ctc_beam_search_decoder(
+      &batch.probs[static_cast<size_t>(job.index) * batch.time_dim * batch.class_dim],
+      job.length,
+      batch.class_dim,
+      batch.alphabet,
+      batch.beam_size,
+      batch.cutoff_prob,
+      batch.cutoff_top_n,
+      batch.ext_scorer,
+      batch.blank_skip_threshold);
+
+    lock.lock();
+    done_.push_back(std::move(utterance));
+    --outstanding_;
+    done_cv_.notify_all();
+  }
+}
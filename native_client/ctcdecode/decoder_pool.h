@@ -0,0 +1,106 @@
+#ifndef DECODER_POOL_H_
+#define DECODER_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "scorer.h"
+#include "output.h"
+#include "alphabet.h"
+
+// Beam search results of an utterance decoded by a DecoderPool
+struct DecodedUtterance {
+  // Number of the batch, as returned by DecoderPool::submit, and index of the
+  // utterance in it. The index is -1 when there was nothing left to decode.
+  int batch = -1;
+  int index = -1;
+  std::vector<Output> outputs;
+};
+
+/* Threads decoding batches of utterances, kept alive from one batch to the
+ * next.
+ *
+ * The utterances of a batch are decoded longest first, so that a long one
+ * does not end up decoded last while the other threads are idle. Results are
+ * returned as soon as each utterance is decoded, letting the caller process
+ * them, or prepare the next batch, while the rest are decoded.
+ */
+class DecoderPool {
+public:
+  explicit DecoderPool(size_t num_threads);
+
+  // Stops the threads, dropping the utterances not being decoded yet
+  ~DecoderPool();
+
+  // Disallow copying
+  DecoderPool(const DecoderPool&) = delete;
+  DecoderPool& operator=(const DecoderPool&) = delete;
+
+  /* Queue a batch for decoding, after the batches submitted before it
+   * Parameters:
+   *     Those of ctc_beam_search_decoder_batch(), but for num_processes. The
+   *     probabilities are copied, ext_scorer must outlive the decoding of
+   *     the batch.
+   * Return:
+   *     The number of the batch, counting from zero.
+  */
+  int submit(const double* probs,
+             int batch_size,
+             int time_dim,
+             int class_dim,
+             const int* seq_lengths,
+             int seq_lengths_size,
+             const Alphabet &alphabet,
+             size_t beam_size,
+             double cutoff_prob,
+             size_t cutoff_top_n,
+             Scorer *ext_scorer,
+             double blank_skip_threshold = 1.0);
+
+  /* Wait for the next utterance to be decoded, in order of completion
+   * Return:
+   *     The decoded utterance, with an index of -1 when no utterance of the
+   *     submitted batches is left.
+  */
+  DecodedUtterance next();
+
+private:
+  struct Batch {
+    int number;
+    std::vector<double> probs;
+    int time_dim;
+    int class_dim;
+    Alphabet alphabet;
+    size_t beam_size;
+    double cutoff_prob;
+    size_t cutoff_top_n;
+    Scorer* ext_scorer; // weak
+    double blank_skip_threshold;
+  };
+
+  struct Job {
+    std::shared_ptr<const Batch> batch;
+    int index;
+    int length;
+  };
+
+  void run();
+
+  std::mutex mutex_;
+  std::condition_variable pending_cv_;
+  std::condition_variable done_cv_;
+  std::deque<Job> pending_;
+  std::deque<DecodedUtterance> done_;
+  // Utterances submitted and not decoded yet
+  size_t outstanding_;
+  int num_batches_;
+  bool stop_;
+
+  std::vector<std::thread> workers_;
+};
+
+#endif  // DECODER_POOL_H_
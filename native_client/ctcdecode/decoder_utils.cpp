@@ -4,38 +4,63 @@
 #include <cmath>
 #include <limits>
 
-std::vector<std::pair<size_t, float>> get_pruned_log_probs(
+const Log1pExpTable LOG1P_EXP_TABLE;
+
+Log1pExpTable::Log1pExpTable() {
+  for (int i = 0; i < SIZE; ++i) {
+    double d = static_cast<double>(i) / LOG1P_EXP_STEPS;
+    double e = std::exp(-d);
+    coefs[i][0] = std::log1p(e);
+    // first derivative, and half the second derivative
+    coefs[i][1] = -e / (1 + e);
+    coefs[i][2] = 0.5 * e / ((1 + e) * (1 + e));
+  }
+}
+
+void get_pruned_log_probs(
     const double *prob_step,
     size_t class_dim,
     double cutoff_prob,
-    size_t cutoff_top_n) {
-  std::vector<std::pair<int, double>> prob_idx;
+    size_t cutoff_top_n,
+    std::vector<std::pair<size_t, double>> &prob_idx,
+    std::vector<std::pair<size_t, float>> &log_prob_idx) {
+  log_prob_idx.clear();
+  if (cutoff_prob >= 1.0) {
+    // classes are only pruned by cumulative probability, keep them all. The
+    // decoder does not depend on their order, so they need no sorting.
+    for (size_t i = 0; i < class_dim; ++i) {
+      log_prob_idx.push_back(std::pair<size_t, float>(
+          i, log(prob_step[i] + NUM_FLT_MIN)));
+    }
+    return;
+  }
+
+  // pruning of vacobulary: at most the cutoff_top_n most likely classes are
+  // kept, so select them in linear time and only sort those
+  prob_idx.clear();
   for (size_t i = 0; i < class_dim; ++i) {
-    prob_idx.push_back(std::pair<int, double>(i, prob_step[i]));
+    prob_idx.push_back(std::pair<size_t, double>(i, prob_step[i]));
   }
-  // pruning of vacobulary
-  size_t cutoff_len = class_dim;
-  if (cutoff_prob < 1.0 || cutoff_top_n < cutoff_len) {
-    std::sort(
-        prob_idx.begin(), prob_idx.end(), pair_comp_second_rev<int, double>);
-    if (cutoff_prob < 1.0) {
-      double cum_prob = 0.0;
-      cutoff_len = 0;
-      for (size_t i = 0; i < prob_idx.size(); ++i) {
-        cum_prob += prob_idx[i].second;
-        cutoff_len += 1;
-        if (cum_prob >= cutoff_prob || cutoff_len >= cutoff_top_n) break;
-      }
-    }
-    prob_idx = std::vector<std::pair<int, double>>(
-        prob_idx.begin(), prob_idx.begin() + cutoff_len);
+  size_t top_n = std::min(std::max<size_t>(cutoff_top_n, 1), class_dim);
+  std::nth_element(prob_idx.begin(),
+                   prob_idx.begin() + top_n - 1,
+                   prob_idx.end(),
+                   pair_comp_second_rev<size_t, double>);
+  std::sort(prob_idx.begin(),
+            prob_idx.begin() + top_n,
+            pair_comp_second_rev<size_t, double>);
+
+  double cum_prob = 0.0;
+  size_t cutoff_len = 0;
+  for (size_t i = 0; i < top_n; ++i) {
+    cum_prob += prob_idx[i].second;
+    cutoff_len += 1;
+    if (cum_prob >= cutoff_prob) break;
   }
-  std::vector<std::pair<size_t, float>> log_prob_idx;
   for (size_t i = 0; i < cutoff_len; ++i) {
-    log_prob_idx.push_back(std::pair<int, float>(
+    log_prob_idx.push_back(std::pair<size_t, float>(
         prob_idx[i].first, log(prob_idx[i].second + NUM_FLT_MIN)));
   }
-  return log_prob_idx;
 }
 
 size_t get_utf8_str_len(const std::string &str) {
@@ -119,46 +144,26 @@ bool prefix_compare_external(const PathTrie *x, const PathTrie *y, const std::un
   }
 }
 
-void add_word_to_fst(const std::vector<int> &word,
-                     fst::StdVectorFst *dictionary) {
-  if (dictionary->NumStates() == 0) {
-    fst::StdVectorFst::StateId start = dictionary->AddState();
-    assert(start == 0);
-    dictionary->SetStart(start);
-  }
-  fst::StdVectorFst::StateId src = dictionary->Start();
-  fst::StdVectorFst::StateId dst;
-  for (auto c : word) {
-    dst = dictionary->AddState();
-    dictionary->AddArc(src, fst::StdArc(c, c, 0, dst));
-    src = dst;
-  }
-  dictionary->SetFinal(dst, fst::StdArc::Weight::One());
-}
-
-bool add_word_to_dictionary(
+bool get_dictionary_labels(
     const std::string &word,
     const std::unordered_map<std::string, int> &char_map,
     bool utf8,
     int SPACE_ID,
-    fst::StdVectorFst *dictionary) {
+    std::vector<int> *labels) {
   auto characters = utf8 ? split_into_bytes(word) : split_into_codepoints(word);
 
-  std::vector<int> int_word;
-
+  labels->clear();
   for (auto &c : characters) {
     auto int_c = char_map.find(c);
     if (int_c != char_map.end()) {
-      int_word.push_back(int_c->second);
+      labels->push_back(int_c->second);
     } else {
-      return false;  // return without adding
+      return false;  // the word can't be spelled with the alphabet
     }
   }
 
   if (!utf8) {
-    int_word.push_back(SPACE_ID);
+    labels->push_back(SPACE_ID);
   }
-
-  add_word_to_fst(int_word, dictionary);
-  return true;  // return with successful adding
+  return true;
 }
\ No newline at end of file
@@ -52,12 +52,54 @@ T log_sum_exp(const T &x, const T &y) {
   return std::log(std::exp(x - xmax) + std::exp(y - xmax)) + xmax;
 }
 
-// Get pruned probability vector for each time step's beam search
-std::vector<std::pair<size_t, float>> get_pruned_log_probs(
+// Table of log(1 + exp(-d)) and its first two derivatives over d in
+// [0, LOG1P_EXP_MAX_DIFF], by steps of 1 / LOG1P_EXP_STEPS
+const int LOG1P_EXP_STEPS = 32;
+const int LOG1P_EXP_MAX_DIFF = 17;
+struct Log1pExpTable {
+  static const int SIZE = LOG1P_EXP_MAX_DIFF * LOG1P_EXP_STEPS + 1;
+  Log1pExpTable();
+  float coefs[SIZE][3];
+};
+extern const Log1pExpTable LOG1P_EXP_TABLE;
+
+// Return log(1 + exp(-d)) for d >= 0, within 1e-7 of the exact value, which
+// is as close as computing it in float with std::exp and std::log. Past
+// LOG1P_EXP_MAX_DIFF the value is below half a float epsilon, and adding it
+// to a log probability would not change it, so zero is returned.
+inline float log1p_exp_neg(float d) {
+  if (!(d < LOG1P_EXP_MAX_DIFF)) return 0.f;
+  // second order expansion around the closest tabulated point
+  int i = static_cast<int>(d * LOG1P_EXP_STEPS + 0.5f);
+  float delta = d - i * (1.f / LOG1P_EXP_STEPS);
+  const float *c = LOG1P_EXP_TABLE.coefs[i];
+  return c[0] + delta * (c[1] + delta * c[2]);
+}
+
+// Return the sum of two probabilities in log scale. The decoder does this
+// for every prefix and class, so the float version avoids calling std::exp
+// and std::log by looking log(1 + exp(-d)) up in a table.
+inline float log_sum_exp(const float &x, const float &y) {
+  static const float num_min = -std::numeric_limits<float>::max();
+  if (x <= num_min) return y;
+  if (y <= num_min) return x;
+  if (x > y) return x + log1p_exp_neg(x - y);
+  return y + log1p_exp_neg(y - x);
+}
+
+// Get pruned log probability vector for each time step's beam search, as
+// (class, log prob) pairs in log_prob_idx. Only when cutoff_prob < 1 are
+// classes pruned, keeping the most likely ones up to a cumulative probability
+// of cutoff_prob and a count of cutoff_top_n, by decreasing probability.
+// prob_idx is scratch space. Both vectors are reused across calls to avoid
+// allocating at each time step.
+void get_pruned_log_probs(
     const double *prob_step,
     size_t class_dim,
     double cutoff_prob,
-    size_t cutoff_top_n);
+    size_t cutoff_top_n,
+    std::vector<std::pair<size_t, double>> &prob_idx,
+    std::vector<std::pair<size_t, float>> &log_prob_idx);
 
 // Functor for prefix comparsion
 bool prefix_compare(const PathTrie *x, const PathTrie *y);
@@ -85,21 +127,18 @@ std::vector<std::string> split_into_codepoints(const std::string &str);
  */
 std::vector<std::string> split_into_bytes(const std::string &str);
 
-// Add a word in index to the dicionary of fst
-void add_word_to_fst(const std::vector<int> &word,
-                     fst::StdVectorFst *dictionary);
-
 // Return whether a byte is a code point boundary (not a continuation byte).
 inline bool byte_is_codepoint_boundary(unsigned char c) {
   // only continuation bytes have their most significant bits set to 10
   return (c & 0xC0) != 0x80;
 }
 
-// Add a word in string to dictionary
-bool add_word_to_dictionary(
+// Convert a word in string to the labels of its path in the dictionary,
+// returning false if some of its characters are not in char_map
+bool get_dictionary_labels(
     const std::string &word,
     const std::unordered_map<std::string, int> &char_map,
     bool utf8,
     int SPACE_ID,
-    fst::StdVectorFst *dictionary);
+    std::vector<int> *labels);
 #endif  // DECODER_UTILS_H
@@ -0,0 +1,149 @@
+#include "dictionary_builder.h"
+
+#include <algorithm>
+#include <utility>
+
+DictionaryBuilder::DictionaryBuilder()
+  : path_(1)
+  , state_first_(1, 0)
+  , register_(0, StateHash{this}, StateEqual{this})
+{
+}
+
+size_t
+DictionaryBuilder::StateHash::operator()(int state) const
+{
+  size_t hash = builder->finals_[state];
+  for (size_t i = builder->state_first_[state]; i < builder->state_first_[state + 1]; ++i) {
+    const Arc& arc = builder->arcs_[i];
+    hash = hash * 31 + arc.ilabel;
+    hash = hash * 31 + arc.olabel;
+    hash = hash * 31 + arc.next_state;
+  }
+  return hash;
+}
+
+bool
+DictionaryBuilder::StateEqual::operator()(int a, int b) const
+{
+  const auto& first = builder->state_first_;
+  if (builder->finals_[a] != builder->finals_[b] ||
+      first[a + 1] - first[a] != first[b + 1] - first[b]) {
+    return false;
+  }
+  return std::equal(builder->arcs_.begin() + first[a],
+                    builder->arcs_.begin() + first[a + 1],
+                    builder->arcs_.begin() + first[b],
+                    [](const Arc& x, const Arc& y) {
+                      return x.ilabel == y.ilabel &&
+                             x.olabel == y.olabel &&
+                             x.next_state == y.next_state;
+                    });
+}
+
+bool
+DictionaryBuilder::add(const std::vector<int>& labels, int word_index)
+{
+  if (labels.empty()) {
+    return false;
+  }
+
+  size_t common = 0;
+  while (common < labels.size() && common < last_word_.size() &&
+         labels[common] == last_word_[common]) {
+    ++common;
+  }
+  if (!last_word_.empty() &&
+      (common == labels.size() || common == last_word_.size() ||
+       labels[common] < last_word_[common])) {
+    return false;
+  }
+
+  // No word added from now on goes below the rest of the last word
+  freeze_path(common + 1);
+
+  for (Node& node : path_) {
+    ++node.count;
+  }
+  for (size_t i = common; i < labels.size(); ++i) {
+    path_.emplace_back();
+    path_.back().count = 1;
+    path_.back().word_index = word_index;
+  }
+  path_.back().final = true;
+
+  last_word_ = labels;
+  return true;
+}
+
+void
+DictionaryBuilder::finish(fst::StdVectorFst* dictionary)
+{
+  dictionary->DeleteStates();
+  if (!last_word_.empty()) {
+    freeze_path(1);
+    const int start = freeze(path_[0], true);
+
+    const int num_states = finals_.size();
+    dictionary->ReserveStates(num_states);
+    for (int s = 0; s < num_states; ++s) {
+      dictionary->AddState();
+    }
+    for (int s = 0; s < num_states; ++s) {
+      dictionary->ReserveArcs(s, state_first_[s + 1] - state_first_[s]);
+      for (size_t i = state_first_[s]; i < state_first_[s + 1]; ++i) {
+        const Arc& arc = arcs_[i];
+        dictionary->AddArc(s, fst::StdArc(arc.ilabel, arc.olabel, fst::StdArc::Weight::One(), arc.next_state));
+      }
+      if (finals_[s]) {
+        dictionary->SetFinal(s, fst::StdArc::Weight::One());
+      }
+    }
+    dictionary->SetStart(start);
+  }
+
+  register_.clear();
+  path_.assign(1, Node());
+  last_word_.clear();
+  state_first_.assign(1, 0);
+  arcs_.clear();
+  finals_.clear();
+}
+
+void
+DictionaryBuilder::freeze_path(size_t depth)
+{
+  while (path_.size() > depth) {
+    Node node = std::move(path_.back());
+    path_.pop_back();
+    const int state = freeze(node, false);
+    path_.back().arcs.push_back(PendingArc{last_word_[path_.size() - 1], state, node.count, node.word_index});
+  }
+}
+
+int
+DictionaryBuilder::freeze(const Node& node, bool is_start)
+{
+  // A word index is output on the arc to the first node from which only
+  // that word is reachable
+  const int state = finals_.size();
+  for (const PendingArc& arc : node.arcs) {
+    const bool output = arc.count == 1 && (is_start || node.count > 1);
+    arcs_.push_back(Arc{arc.label, output ? arc.word_index : 0, arc.next_state});
+  }
+  state_first_.push_back(arcs_.size());
+  finals_.push_back(node.final);
+
+  if (is_start) {
+    return state;
+  }
+  auto registered = register_.insert(state);
+  if (!registered.second) {
+    // Drop the state, in favor of the equivalent one
+    arcs_.resize(state_first_[state]);
+    state_first_.pop_back();
+    finals_.pop_back();
+    return *registered.first;
+  }
+  return state;
+}
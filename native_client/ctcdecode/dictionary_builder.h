@@ -0,0 +1,94 @@
+#ifndef DICTIONARY_BUILDER_H_
+#define DICTIONARY_BUILDER_H_
+
+#include <cstddef>
+#include <unordered_set>
+#include <vector>
+
+#include "fst/fstlib.h"
+
+/* Builds the dictionary FST in a single pass over words given in increasing
+ * lexicographic order of their labels, minimizing it along the way (Daciuk et
+ * al., Incremental Construction of Minimal Acyclic Finite-State Automata).
+ *
+ * The result is the deterministic and minimal FST that RmEpsilon, Determinize
+ * and Minimize give from the words added as separate paths: each word index
+ * is output on the first arc after which the word is the only one reachable.
+ * Only the suffix of the last word that is not shared with the next one is
+ * kept unminimized, so time and memory are linear in the number of labels.
+ *
+ * The words must be prefix free, which dictionary words are as they end with
+ * a space, or consist of a single UTF-8 character in UTF-8 mode.
+ */
+class DictionaryBuilder {
+public:
+  DictionaryBuilder();
+
+  // Disallow copying
+  DictionaryBuilder(const DictionaryBuilder&) = delete;
+  DictionaryBuilder& operator=(const DictionaryBuilder&) = delete;
+
+  // Add a word, which must come after the previous one and not extend it.
+  // Returns false, adding nothing, otherwise.
+  bool add(const std::vector<int>& labels, int word_index);
+
+  // Write the FST of the words added so far in dictionary, clearing the
+  // builder for a new set of words
+  void finish(fst::StdVectorFst* dictionary);
+
+private:
+  // Arc of a node whose state is not known yet, to the (registered) state of
+  // next_state, from which count words are reachable
+  struct PendingArc {
+    int label;
+    int next_state;
+    int count;
+    int word_index;
+  };
+
+  // Node along the last word, which can still get arcs
+  struct Node {
+    std::vector<PendingArc> arcs;
+    // number of words reachable from the node, the first one being word_index
+    int count = 0;
+    int word_index = 0;
+    bool final = false;
+  };
+
+  struct Arc {
+    int ilabel;
+    int olabel;
+    int next_state;
+  };
+
+  // Hash and equality of registered states, by their arcs and finality
+  struct StateHash {
+    const DictionaryBuilder* builder;
+    size_t operator()(int state) const;
+  };
+  struct StateEqual {
+    const DictionaryBuilder* builder;
+    bool operator()(int a, int b) const;
+  };
+
+  // turn the nodes below depth into states, starting from the deepest one
+  void freeze_path(size_t depth);
+
+  // return the state of node, an equivalent one if it was registered already
+  int freeze(const Node& node, bool is_start);
+
+  // Nodes of the last word, path_[0] being the start state
+  std::vector<Node> path_;
+  std::vector<int> last_word_;
+
+  // The arcs of state s are at positions state_first_[s] to
+  // state_first_[s + 1] in arcs_
+  std::vector<size_t> state_first_;
+  std::vector<Arc> arcs_;
+  std::vector<bool> finals_;
+
+  // states without equivalent, the start state aside
+  std::unordered_set<int, StateHash, StateEqual> register_;
+};
+
+#endif  // DICTIONARY_BUILDER_H_
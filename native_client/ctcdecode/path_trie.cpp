@@ -1,6 +1,7 @@
 #include "path_trie.h"
 
 #include <algorithm>
+#include <bitset>
 #include <limits>
 #include <memory>
 #include <utility>
@@ -8,7 +9,9 @@
 
 #include "decoder_utils.h"
 
-PathTrie::PathTrie() {
+PathTrie::PathTrie(PathTrieAllocator* allocator) {
+  allocator_ = allocator;
+
   log_prob_b_prev = -NUM_FLT_INF;
   log_prob_nb_prev = -NUM_FLT_INF;
   log_prob_b_cur = -NUM_FLT_INF;
@@ -16,101 +19,167 @@ PathTrie::PathTrie() {
   log_prob_c = -NUM_FLT_INF;
   score = -NUM_FLT_INF;
 
-  ROOT_ = -1;
   character = ROOT_;
   timestep = 0;
   exists_ = true;
   parent = nullptr;
 
+  has_lm_state = false;
+  lm = nullptr;
+  word_index = lm::kUNK;
+
+  first_child_step_ = 0;
+  child_mask_ = 0;
+
   dictionary_ = nullptr;
   dictionary_state_ = 0;
-  has_dictionary_ = false;
-
-  matcher_ = nullptr;
 }
 
 PathTrie::~PathTrie() {
   for (auto child : children_) {
-    delete child.second;
-  }
-}
-
-PathTrie* PathTrie::get_path_trie(int new_char, int new_timestep, float cur_log_prob_c, bool reset) {
-  auto child = children_.begin();
-  for (child = children_.begin(); child != children_.end(); ++child) {
-    if (child->first == new_char) {
-      // If existing child matches this new_char but had a lower probability,
-      // and it's a leaf, update its timestep to new_timestep.
-      // The leak check makes sure we don't update the child to have a later
-      // timestep than a grandchild.
-      if (child->second->log_prob_c < cur_log_prob_c &&
-          child->second->children_.size() == 0) {
-        child->second->log_prob_c = cur_log_prob_c;
-        child->second->timestep = new_timestep;
-      }
-      break;
+    destroy(child.second);
+  }
+  if (lm != nullptr) {
+    allocator_->deallocate_lm_state(lm);
+  }
+}
+
+PathTrie* PathTrie::create_root(PathTrieAllocator& allocator) {
+  return new (allocator.allocate()) PathTrie(&allocator);
+}
+
+void PathTrie::destroy(PathTrie* node) {
+  PathTrieAllocator* allocator = node->allocator_;
+  node->~PathTrie();
+  allocator->deallocate(node);
+}
+
+PathTrie* PathTrie::new_node(PathTrieAllocator* allocator) {
+  return new (allocator->allocate()) PathTrie(allocator);
+}
+
+size_t PathTrie::find_child(int c) const {
+  if (c >= 0 && c < MASK_BITS_) {
+    std::uint64_t bit = std::uint64_t(1) << c;
+    if ((child_mask_ & bit) == 0) {
+      return children_.size();
     }
+    return std::bitset<MASK_BITS_>(child_mask_ & (bit - 1)).count();
+  }
+  // number of children for masked characters, which come first
+  size_t n_masked = std::bitset<MASK_BITS_>(child_mask_).count();
+  auto child = std::lower_bound(children_.begin() + n_masked, children_.end(), c,
+                                [](const std::pair<int, PathTrie*>& entry, int value) {
+                                  return entry.first < value;
+                                });
+  if (child == children_.end() || child->first != c) {
+    return children_.size();
   }
+  return child - children_.begin();
+}
+
+PathTrie* PathTrie::get_path_trie(int new_char,
+                                  int new_timestep,
+                                  float cur_log_prob_c,
+                                  std::vector<PathTrie*>& new_prefixes,
+                                  bool reset,
+                                  PathTrieAllocator* allocator) {
+  if (allocator == nullptr) {
+    allocator = allocator_;
+  }
+  size_t index = find_child(new_char);
+  auto child = children_.begin() + index;
   if (child != children_.end()) {
+    // If existing child matches this new_char but had a lower probability,
+    // and it's a leaf, update its timestep to new_timestep.
+    // The leaf check makes sure we don't update the child to have a later
+    // timestep than a grandchild. Grandchildren of this time step don't
+    // count, so that the order prefixes are extended in doesn't matter.
+    if (child->second->log_prob_c < cur_log_prob_c &&
+        child->second->is_leaf_before(new_timestep)) {
+      child->second->log_prob_c = cur_log_prob_c;
+      child->second->timestep = new_timestep;
+    }
     if (!child->second->exists_) {
       child->second->exists_ = true;
       child->second->log_prob_b_prev = -NUM_FLT_INF;
       child->second->log_prob_nb_prev = -NUM_FLT_INF;
       child->second->log_prob_b_cur = -NUM_FLT_INF;
       child->second->log_prob_nb_cur = -NUM_FLT_INF;
+      new_prefixes.push_back(child->second);
     }
     return child->second;
   } else {
-    if (has_dictionary_) {
-      matcher_->SetState(dictionary_state_);
-      bool found = matcher_->Find(new_char + 1);
+    PathTrie* new_path = nullptr;
+    if (dictionary_ != nullptr) {
+      TransitionTable::StateId next_state;
+      int output;
+      bool found = dictionary_->find(dictionary_state_, new_char + 1, &next_state, &output);
       if (!found) {
         // Adding this character causes word outside dictionary
-        auto FSTZERO = fst::TropicalWeight::Zero();
-        auto final_weight = dictionary_->Final(dictionary_state_);
-        bool is_final = (final_weight != FSTZERO);
-        if (is_final && reset) {
-          dictionary_state_ = dictionary_->Start();
+        if (dictionary_->is_final(dictionary_state_) && reset) {
+          dictionary_state_ = dictionary_->start();
         }
         return nullptr;
       } else {
-        PathTrie* new_path = new PathTrie;
+        new_path = new_node(allocator);
         new_path->character = new_char;
         new_path->timestep = new_timestep;
         new_path->parent = this;
         new_path->dictionary_ = dictionary_;
-        new_path->has_dictionary_ = true;
-        new_path->matcher_ = matcher_;
         new_path->log_prob_c = cur_log_prob_c;
 
+        // the word index is output once the path identifies the word, and
+        // applies to the rest of it
+        if (output != 0) {
+          new_path->word_index = output;
+        } else if (dictionary_state_ != dictionary_->start()) {
+          new_path->word_index = word_index;
+        }
+
         // set spell checker state
         // check to see if next state is final
-        auto FSTZERO = fst::TropicalWeight::Zero();
-        auto final_weight = dictionary_->Final(matcher_->Value().nextstate);
-        bool is_final = (final_weight != FSTZERO);
-        if (is_final && reset) {
+        if (dictionary_->is_final(next_state) && reset) {
           // restart spell checker at the start state
-          new_path->dictionary_state_ = dictionary_->Start();
+          new_path->dictionary_state_ = dictionary_->start();
         } else {
           // go to next state
-          new_path->dictionary_state_ = matcher_->Value().nextstate;
+          new_path->dictionary_state_ = next_state;
         }
-
-        children_.push_back(std::make_pair(new_char, new_path));
-        return new_path;
       }
     } else {
-      PathTrie* new_path = new PathTrie;
+      new_path = new_node(allocator);
       new_path->character = new_char;
       new_path->timestep = new_timestep;
       new_path->parent = this;
       new_path->log_prob_c = cur_log_prob_c;
-      children_.push_back(std::make_pair(new_char, new_path));
-      return new_path;
     }
+
+    // keep children sorted by character
+    auto position = std::lower_bound(children_.begin(), children_.end(), new_char,
+                                     [](const std::pair<int, PathTrie*>& entry, int value) {
+                                       return entry.first < value;
+                                     });
+    if (children_.empty()) {
+      first_child_step_ = new_timestep;
+    }
+    children_.insert(position, std::make_pair(new_char, new_path));
+    if (new_char >= 0 && new_char < MASK_BITS_) {
+      child_mask_ |= std::uint64_t(1) << new_char;
+    }
+    new_prefixes.push_back(new_path);
+    return new_path;
   }
 }
 
+PathTrie* PathTrie::get_existing_child(int new_char) const {
+  size_t index = find_child(new_char);
+  if (index < children_.size() && children_[index].second->exists_) {
+    return children_[index].second;
+  }
+  return nullptr;
+}
+
 void PathTrie::get_path_vec(std::vector<int>& output, std::vector<int>& timesteps) {
   // Recursive call: recurse back until stop condition, then append data in
   // correct order as we walk back down the stack in the lines below.
@@ -173,19 +242,19 @@ PathTrie* PathTrie::get_prev_word(std::vector<int>& output,
   return stop;
 }
 
-void PathTrie::iterate_to_vec(std::vector<PathTrie*>& output) {
-  if (exists_) {
-    log_prob_b_prev = log_prob_b_cur;
-    log_prob_nb_prev = log_prob_nb_cur;
+void PathTrie::advance() {
+  log_prob_b_prev = log_prob_b_cur;
+  log_prob_nb_prev = log_prob_nb_cur;
 
-    log_prob_b_cur = -NUM_FLT_INF;
-    log_prob_nb_cur = -NUM_FLT_INF;
+  log_prob_b_cur = -NUM_FLT_INF;
+  log_prob_nb_cur = -NUM_FLT_INF;
 
-    score = log_sum_exp(log_prob_b_prev, log_prob_nb_prev);
-    output.push_back(this);
-  }
-  for (auto child : children_) {
-    child.second->iterate_to_vec(output);
+  score = log_sum_exp(log_prob_b_prev, log_prob_nb_prev);
+}
+
+void PathTrie::reserve_lm_state() {
+  if (lm == nullptr) {
+    lm = allocator_->allocate_lm_state();
   }
 }
 
@@ -193,10 +262,11 @@ void PathTrie::remove() {
   exists_ = false;
 
   if (children_.size() == 0) {
-    for (auto child = parent->children_.begin(); child != parent->children_.end(); ++child) {
-      if (child->first == character) {
-        parent->children_.erase(child);
-        break;
+    size_t index = parent->find_child(character);
+    if (index < parent->children_.size()) {
+      parent->children_.erase(parent->children_.begin() + index);
+      if (character >= 0 && character < MASK_BITS_) {
+        parent->child_mask_ &= ~(std::uint64_t(1) << character);
       }
     }
 
@@ -204,18 +274,50 @@ void PathTrie::remove() {
       parent->remove();
     }
 
-    delete this;
+    destroy(this);
   }
 }
 
-void PathTrie::set_dictionary(std::shared_ptr<PathTrie::FstType> dictionary) {
-  dictionary_ = dictionary;
-  dictionary_state_ = dictionary_->Start();
-  has_dictionary_ = true;
+PathTrie* PathTrie::clone(PathTrie* new_parent,
+                          PathTrieAllocator& allocator,
+                          std::unordered_map<const PathTrie*, PathTrie*>& mapping) const {
+  PathTrie* copy = new (allocator.allocate()) PathTrie(&allocator);
+  copy->log_prob_b_prev = log_prob_b_prev;
+  copy->log_prob_nb_prev = log_prob_nb_prev;
+  copy->log_prob_b_cur = log_prob_b_cur;
+  copy->log_prob_nb_cur = log_prob_nb_cur;
+  copy->log_prob_c = log_prob_c;
+  copy->score = score;
+  copy->approx_ctc = approx_ctc;
+  copy->character = character;
+  copy->timestep = timestep;
+  copy->parent = new_parent;
+
+  copy->has_lm_state = has_lm_state;
+  if (lm != nullptr) {
+    copy->reserve_lm_state();
+    *copy->lm = *lm;
+  }
+  copy->word_index = word_index;
+
+  copy->exists_ = exists_;
+  copy->first_child_step_ = first_child_step_;
+  copy->child_mask_ = child_mask_;
+  copy->dictionary_ = dictionary_;
+  copy->dictionary_state_ = dictionary_state_;
+  mapping[this] = copy;
+
+  copy->children_.reserve(children_.size());
+  for (auto child : children_) {
+    copy->children_.push_back(std::make_pair(child.first,
+                                             child.second->clone(copy, allocator, mapping)));
+  }
+  return copy;
 }
 
-void PathTrie::set_matcher(std::shared_ptr<fst::SortedMatcher<FstType>> matcher) {
-  matcher_ = matcher;
+void PathTrie::set_dictionary(const TransitionTable* dictionary) {
+  dictionary_ = dictionary;
+  dictionary_state_ = dictionary_->start();
 }
 
 #ifdef DEBUG
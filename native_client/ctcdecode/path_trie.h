@@ -2,29 +2,124 @@
 #define PATH_TRIE_H
 
 #include <algorithm>
+#include <cstdint>
 #include <limits>
 #include <memory>
+#include <new>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
-#include "fst/fstlib.h"
+#include "lm/state.hh"
+#include "lm/word_index.hh"
+#include "util/pool.hh"
+
+#include "transition_table.h"
 
 #ifdef DEBUG
 #include "alphabet.h"
 #endif
 
+/* Language model data of a node ending a scored unit (word or grapheme),
+ * kept apart from the nodes as most of them are within a unit.
+ * units_since_oov is how many units back the last out of vocabulary one is,
+ * zero if it is this node's unit, and at most the language model order.
+ */
+struct PathTrieLmState {
+  lm::ngram::State state;
+  double score;
+  int units_since_oov;
+};
+
+/* Allocator for the nodes of a prefix trie and their language model data,
+ * owned by the decoder state. Both are carved out of large blocks, and freed
+ * ones are kept in a free list for reuse by later allocations. Blocks are all
+ * given back at once when the allocator is destroyed, after all its nodes
+ * have been destroyed.
+ */
+class PathTrieAllocator {
+public:
+  PathTrieAllocator(std::size_t node_size)
+    : nodes_(node_size)
+    , lm_states_(sizeof(PathTrieLmState)) {}
+
+  void* allocate() { return nodes_.allocate(); }
+
+  void deallocate(void* memory) { nodes_.deallocate(memory); }
+
+  PathTrieLmState* allocate_lm_state() {
+    return new (lm_states_.allocate()) PathTrieLmState();
+  }
+
+  void deallocate_lm_state(PathTrieLmState* lm_state) {
+    lm_state->~PathTrieLmState();
+    lm_states_.deallocate(lm_state);
+  }
+
+private:
+  class Pool {
+  public:
+    Pool(std::size_t size)
+      : size_(std::max(size, sizeof(FreeNode)))
+      , free_list_(nullptr) {}
+
+    void* allocate() {
+      if (free_list_ != nullptr) {
+        FreeNode* node = free_list_;
+        free_list_ = node->next;
+        return node;
+      }
+      return pool_.Allocate(size_);
+    }
+
+    void deallocate(void* memory) {
+      FreeNode* node = static_cast<FreeNode*>(memory);
+      node->next = free_list_;
+      free_list_ = node;
+    }
+
+  private:
+    struct FreeNode {
+      FreeNode* next;
+    };
+
+    std::size_t size_;
+    FreeNode* free_list_;
+    util::Pool pool_;
+  };
+
+  Pool nodes_;
+  Pool lm_states_;
+};
+
 /* Trie tree for prefix storing and manipulating, with a dictionary in
  * finite-state transducer for spelling correction.
  */
 class PathTrie {
 public:
-  using FstType = fst::ConstFst<fst::StdArc>;
-
-  PathTrie();
-  ~PathTrie();
-
-  // get new prefix after appending new char
-  PathTrie* get_path_trie(int new_char, int new_timestep, float log_prob_c, bool reset = true);
+  // create a root node, whose descendants are allocated with allocator
+  static PathTrie* create_root(PathTrieAllocator& allocator);
+
+  // destroy a node and its descendants, giving their memory back
+  static void destroy(PathTrie* node);
+
+  struct Deleter {
+    void operator()(PathTrie* node) const { destroy(node); }
+  };
+
+  // get new prefix after appending new char. If the new prefix did not exist
+  // before, it is appended to new_prefixes. New nodes are allocated with
+  // allocator, or that of the current node if it is null.
+  PathTrie* get_path_trie(int new_char,
+                          int new_timestep,
+                          float log_prob_c,
+                          std::vector<PathTrie*>& new_prefixes,
+                          bool reset = true,
+                          PathTrieAllocator* allocator = nullptr);
+
+  // existing prefix after appending new char, without updating it, or null
+  // if there is none
+  PathTrie* get_existing_child(int new_char) const;
 
   // get the prefix data in correct time order from root to current node
   void get_path_vec(std::vector<int>& output, std::vector<int>& timesteps);
@@ -41,24 +136,40 @@ public:
                           std::vector<int>& timesteps,
                           int space_id);
 
-  // update log probs
-  void iterate_to_vec(std::vector<PathTrie*>& output);
-
-  // set dictionary for FST
-  void set_dictionary(std::shared_ptr<FstType> dictionary);
+  // update log probs at the end of a time step
+  void advance();
 
-  void set_matcher(std::shared_ptr<fst::SortedMatcher<FstType>>);
+  // set the transitions of the dictionary FST. They are owned by the caller
+  // and must outlive the trie.
+  void set_dictionary(const TransitionTable* dictionary);
 
   bool is_empty() { return ROOT_ == character; }
 
+  bool is_leaf() const { return children_.empty(); }
+
+  // whether the node had no children before time step t, which it can then
+  // be moved to without getting a later timestep than its children
+  bool is_leaf_before(int t) const { return children_.empty() || first_child_step_ == t; }
+
+  // allocate lm, if not done yet, from the allocator of the node
+  void reserve_lm_state();
+
   // remove current path from root
   void remove();
 
+  // deep copy of the subtree rooted at the current node, attached to parent.
+  // Copied nodes share the dictionary of the original ones, and each copied
+  // node is recorded in mapping along with its original.
+  PathTrie* clone(PathTrie* parent,
+                  PathTrieAllocator& allocator,
+                  std::unordered_map<const PathTrie*, PathTrie*>& mapping) const;
+
 #ifdef DEBUG
   void vec(std::vector<PathTrie*>& out);
   void print(const Alphabet& a);
 #endif // DEBUG
 
+  // Scores, read and written for every prefix at every time step
   float log_prob_b_prev;
   float log_prob_nb_prev;
   float log_prob_b_cur;
@@ -70,18 +181,46 @@ public:
   int timestep;
   PathTrie* parent;
 
+  // Language model state after the scored unit that ends at this node, and
+  // the score of that unit, once the scorer computed them. lm is only
+  // allocated for the nodes that end a unit, possibly before it is scored.
+  PathTrieLmState* lm;
+  bool has_lm_state;
+  // Index in the language model vocabulary of the dictionary word this node
+  // belongs to, once the path identifies it, or lm::kUNK
+  lm::WordIndex word_index;
+
 private:
-  int ROOT_;
+  explicit PathTrie(PathTrieAllocator* allocator);
+  ~PathTrie();
+
+  // allocate a node from allocator, which it is given back to when destroyed
+  static PathTrie* new_node(PathTrieAllocator* allocator);
+
+  // position of the child for character c in children_, or children_.size()
+  // if there is none
+  size_t find_child(int c) const;
+
+  static constexpr int ROOT_ = -1;
+  // characters below this value are indexed by child_mask_
+  static constexpr int MASK_BITS_ = 64;
+
   bool exists_;
-  bool has_dictionary_;
+  // time step at which the node last got its first child
+  int first_child_step_;
 
+  // Children sorted by character. Bit c of child_mask_ is set when there is a
+  // child for character c < MASK_BITS_, which locates it in constant time.
+  // Larger characters are found by binary search past the masked ones.
+  std::uint64_t child_mask_;
   std::vector<std::pair<int, PathTrie*>> children_;
 
-  // pointer to dictionary of FST
-  std::shared_ptr<FstType> dictionary_;
-  FstType::StateId dictionary_state_;
-  // true if finding ars in FST
-  std::shared_ptr<fst::SortedMatcher<FstType>> matcher_;
+  // Allocator the node came from and goes back to, also used by default for
+  // its children. The dictionary is the same for all nodes of a trie.
+  PathTrieAllocator* allocator_;
+  // transitions of the dictionary FST, null when decoding without one
+  const TransitionTable* dictionary_;
+  TransitionTable::StateId dictionary_state_;
 };
 
 #endif  // PATH_TRIE_H
@@ -0,0 +1,103 @@
+#ifndef SCORE_CACHE_H_
+#define SCORE_CACHE_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "lm/state.hh"
+#include "lm/word_index.hh"
+
+/* Bounded cache of language model queries, mapping a context state and a
+ * word to the log10 probability of the word and the state after it.
+ *
+ * The cache is direct mapped: each (state, word) pair has a single slot,
+ * picked from its hash, and a new query evicts whatever was there before.
+ * Lookups and insertions are thus constant time and never allocate once the
+ * table exists, which it does from the first insertion on.
+ *
+ * Hit and miss counters tell how many language model lookups were saved.
+ */
+class ScoreCache {
+public:
+  static const size_t DEFAULT_CAPACITY = 1 << 12;
+
+  // capacity is rounded up to a power of two
+  explicit ScoreCache(size_t capacity = DEFAULT_CAPACITY)
+    : mask_(1)
+    , hits_(0)
+    , misses_(0)
+  {
+    while (mask_ < capacity) {
+      mask_ <<= 1;
+    }
+    --mask_;
+  }
+
+  // look the query up, filling prob and out_state on a hit
+  bool find(const lm::ngram::State& in_state,
+            lm::WordIndex word,
+            float* prob,
+            lm::ngram::State* out_state)
+  {
+    if (!entries_.empty()) {
+      const Entry& entry = entries_[slot(in_state, word)];
+      if (entry.used && entry.word == word && entry.in_state == in_state) {
+        *prob = entry.prob;
+        *out_state = entry.out_state;
+        ++hits_;
+        return true;
+      }
+    }
+    ++misses_;
+    return false;
+  }
+
+  void insert(const lm::ngram::State& in_state,
+              lm::WordIndex word,
+              float prob,
+              const lm::ngram::State& out_state)
+  {
+    if (entries_.empty()) {
+      entries_.resize(mask_ + 1);
+    }
+    Entry& entry = entries_[slot(in_state, word)];
+    entry.used = true;
+    entry.word = word;
+    entry.prob = prob;
+    entry.in_state = in_state;
+    entry.out_state = out_state;
+  }
+
+  // forget all entries, and the counters
+  void clear()
+  {
+    entries_.clear();
+    hits_ = 0;
+    misses_ = 0;
+  }
+
+  size_t capacity() const { return mask_ + 1; }
+  size_t hits() const { return hits_; }
+  size_t misses() const { return misses_; }
+
+private:
+  struct Entry {
+    bool used = false;
+    lm::WordIndex word;
+    float prob;
+    lm::ngram::State in_state;
+    lm::ngram::State out_state;
+  };
+
+  size_t slot(const lm::ngram::State& in_state, lm::WordIndex word) const
+  {
+    return lm::ngram::hash_value(in_state, word) & mask_;
+  }
+
+  size_t mask_;
+  size_t hits_;
+  size_t misses_;
+  std::vector<Entry> entries_;
+};
+
+#endif  // SCORE_CACHE_H_
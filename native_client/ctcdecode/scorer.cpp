@@ -14,20 +14,37 @@
 #endif
 
 #include "scorer.h"
+#include <algorithm>
+#include <cstdio>
 #include <iostream>
 #include <fstream>
+#include <queue>
+#include <thread>
 
 #include "lm/config.hh"
 #include "lm/model.hh"
 #include "lm/state.hh"
+#include "util/ersatz_progress.hh"
+#include "util/file.hh"
 #include "util/string_piece.hh"
 
+#include "ThreadPool.h"
 #include "decoder_utils.h"
+#include "dictionary_builder.h"
 
 using namespace lm::ngram;
 
 static const int32_t MAGIC = 'TRIE';
-static const int32_t FILE_VERSION = 5;
+static const int32_t FILE_VERSION = 7;
+// Version storing the dictionary as an FST, which is converted on load
+static const int32_t FST_FILE_VERSION = 6;
+// Version without language model word indices, which is upgraded on load
+static const int32_t LEGACY_FILE_VERSION = 5;
+// The dictionary starts at this offset in trie files, 8 bytes aligned so it
+// can be used in place when the file is mapped
+static const size_t DICTIONARY_OFFSET = 16;
+// Number of vocabulary words each task spells when building a dictionary
+static const size_t DICTIONARY_SHARE_SIZE = 1 << 14;
 
 int
 Scorer::init(double alpha,
@@ -102,9 +119,6 @@ void Scorer::setup(const std::string& lm_path, const std::string& trie_path)
     // Add spaces only in word-based scoring
     fill_dictionary(vocab);
   } else {
-    config.load_method = util::LoadMethod::LAZY;
-    language_model_.reset(lm::ngram::LoadVirtual(filename, config));
-
     // Read metadata and trie from file
     std::ifstream fin(trie_path, std::ios::binary);
 
@@ -118,7 +132,8 @@ void Scorer::setup(const std::string& lm_path, const std::string& trie_path)
 
     int version;
     fin.read(reinterpret_cast<char*>(&version), sizeof(version));
-    if (version != FILE_VERSION) {
+    if (version != FILE_VERSION && version != FST_FILE_VERSION &&
+        version != LEGACY_FILE_VERSION) {
       std::cerr << "Error: Trie file version mismatch (" << version
                 << " instead of expected " << FILE_VERSION
                 << "). Update your trie file."
@@ -128,25 +143,98 @@ void Scorer::setup(const std::string& lm_path, const std::string& trie_path)
 
     fin.read(reinterpret_cast<char*>(&is_utf8_mode_), sizeof(is_utf8_mode_));
 
-    fst::FstReadOptions opt;
-    opt.mode = fst::FstReadOptions::MAP;
-    opt.source = trie_path;
-    dictionary.reset(FstType::Read(fin, opt));
+    if (version == LEGACY_FILE_VERSION) {
+      // The dictionary lacks word indices, build it again from the vocabulary
+      std::cerr << "Warning: Trie file version " << version << " is outdated, "
+                   "rebuilding it from the language model. Update your trie "
+                   "file with convert_trie or generate_trie to speed up "
+                   "loading." << std::endl;
+      RetrieveStrEnumerateVocab enumerate;
+      config.enumerate_vocab = &enumerate;
+      language_model_.reset(lm::ngram::LoadVirtual(filename, config));
+      fill_dictionary(enumerate.vocabulary);
+    } else if (version == FST_FILE_VERSION) {
+      std::cerr << "Warning: Trie file version " << version << " is outdated, "
+                   "converting its dictionary on load. Update your trie file "
+                   "with convert_trie to speed up loading and save memory."
+                << std::endl;
+      config.load_method = util::LoadMethod::LAZY;
+      language_model_.reset(lm::ngram::LoadVirtual(filename, config));
+
+      fst::FstReadOptions opt;
+      opt.mode = fst::FstReadOptions::MAP;
+      opt.source = trie_path;
+      std::unique_ptr<FstType> fst_dictionary(FstType::Read(fin, opt));
+      if (!fst_dictionary) {
+        std::cerr << "Error: Can't parse trie file, invalid dictionary. "
+                     "Update your trie file." << std::endl;
+        throw 1;
+      }
+      dictionary.reset(new TransitionTable(*fst_dictionary));
+    } else {
+      config.load_method = util::LoadMethod::LAZY;
+      language_model_.reset(lm::ngram::LoadVirtual(filename, config));
+
+      // Use the dictionary straight from the mapped file, the mapping being
+      // of the whole file as its offset has to be page aligned
+      util::scoped_fd fd(util::OpenReadOrThrow(trie_path.c_str()));
+      const uint64_t size = util::SizeOrThrow(fd.get());
+      if (size > DICTIONARY_OFFSET) {
+        util::MapRead(util::LAZY, fd.get(), 0, size, dictionary_memory_);
+        dictionary.reset(new TransitionTable(
+          static_cast<const char*>(dictionary_memory_.get()) + DICTIONARY_OFFSET,
+          size - DICTIONARY_OFFSET));
+      }
+      if (!dictionary || !dictionary->valid()) {
+        std::cerr << "Error: Can't parse trie file, invalid dictionary. "
+                     "Update your trie file." << std::endl;
+        throw 1;
+      }
+    }
   }
 
   max_order_ = language_model_->Order();
+  language_model_->BeginSentenceWrite(&begin_state_);
 }
 
-void Scorer::save_dictionary(const std::string& path)
+int Scorer::save_dictionary(const std::string& path)
 {
-  std::ofstream fout(path, std::ios::binary);
-  fout.write(reinterpret_cast<const char*>(&MAGIC), sizeof(MAGIC));
-  fout.write(reinterpret_cast<const char*>(&FILE_VERSION), sizeof(FILE_VERSION));
-  fout.write(reinterpret_cast<const char*>(&is_utf8_mode_), sizeof(is_utf8_mode_));
-  fst::FstWriteOptions opt;
-  opt.align = true;
-  opt.source = path;
-  dictionary->Write(fout, opt);
+  // Write to a temporary file first: the dictionary may be mapped from the
+  // file being replaced, which truncating would corrupt
+  const std::string temp_path = path + ".tmp";
+  {
+    std::ofstream fout(temp_path, std::ios::binary);
+    fout.write(reinterpret_cast<const char*>(&MAGIC), sizeof(MAGIC));
+    fout.write(reinterpret_cast<const char*>(&FILE_VERSION), sizeof(FILE_VERSION));
+    fout.write(reinterpret_cast<const char*>(&is_utf8_mode_), sizeof(is_utf8_mode_));
+    const char padding[DICTIONARY_OFFSET] = {};
+    fout.write(padding, DICTIONARY_OFFSET - sizeof(MAGIC) - sizeof(FILE_VERSION) - sizeof(is_utf8_mode_));
+    dictionary->write(fout);
+    fout.close();
+    if (!fout) {
+      std::cerr << "Error: Can't write trie file " << temp_path << std::endl;
+      std::remove(temp_path.c_str());
+      return 1;
+    }
+  }
+
+#ifdef _MSC_VER
+  // Windows can't replace a file that is still mapped, which the dictionary
+  // may be mapped from. POSIX systems keep the old file for the mapping.
+  if (dictionary_memory_.get()) {
+    dictionary->copy_data();
+    dictionary_memory_.reset();
+  }
+  const bool renamed = MoveFileExA(temp_path.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  const bool renamed = std::rename(temp_path.c_str(), path.c_str()) == 0;
+#endif
+  if (!renamed) {
+    std::cerr << "Error: Can't replace trie file " << path << std::endl;
+    std::remove(temp_path.c_str());
+    return 1;
+  }
+  return 0;
 }
 
 bool Scorer::is_scoring_boundary(PathTrie* prefix, size_t new_label)
@@ -267,6 +355,165 @@ double Scorer::get_sent_log_prob(const std::vector<std::string>& words)
   return score / NUM_FLT_LOGE;
 }
 
+double Scorer::get_prefix_log_cond_prob(PathTrie* prefix,
+                                        PathTrie* boundary,
+                                        ScoreCache* cache)
+{
+  if (!boundary->has_lm_state) {
+    score_unit(get_prev_unit(prefix, cache), boundary, cache);
+  }
+  return boundary->lm->score;
+}
+
+void Scorer::score_prefixes(const std::vector<std::pair<PathTrie*, PathTrie*>>& prefixes,
+                            ScoreCache* cache)
+{
+  std::vector<PathTrie*> previous;
+  find_prev_units(prefixes, &previous, cache);
+  score_units(prefixes, previous, 0, prefixes.size(), cache);
+}
+
+void Scorer::find_prev_units(const std::vector<std::pair<PathTrie*, PathTrie*>>& prefixes,
+                             std::vector<PathTrie*>* previous,
+                             ScoreCache* cache)
+{
+  // First find where each unit is scored from, and let the language model
+  // start loading what it will need for all of them
+  previous->assign(prefixes.size(), nullptr);
+  for (size_t i = 0; i < prefixes.size(); ++i) {
+    PathTrie* boundary = prefixes[i].second;
+    if (boundary->has_lm_state) {
+      continue;
+    }
+    (*previous)[i] = get_prev_unit(prefixes[i].first, cache);
+    const lm::ngram::State* in_state = (*previous)[i]->is_empty() ? &begin_state_ : &(*previous)[i]->lm->state;
+    language_model_->BasePrefetch(in_state, boundary->word_index);
+  }
+
+  // units scored by get_prev_unit, as the previous unit of another one, are
+  // left alone from now on. The others get their language model data here,
+  // as score_units may run on threads that don't own their allocators.
+  for (size_t i = 0; i < prefixes.size(); ++i) {
+    if (prefixes[i].second->has_lm_state) {
+      (*previous)[i] = nullptr;
+    } else {
+      prefixes[i].second->reserve_lm_state();
+    }
+  }
+}
+
+void Scorer::score_units(const std::vector<std::pair<PathTrie*, PathTrie*>>& prefixes,
+                         const std::vector<PathTrie*>& previous,
+                         size_t begin,
+                         size_t end,
+                         ScoreCache* cache)
+{
+  for (size_t i = begin; i < end; ++i) {
+    // a boundary listed twice is only scored once
+    if (previous[i] != nullptr && !prefixes[i].second->has_lm_state) {
+      score_unit(previous[i], prefixes[i].second, cache);
+    }
+  }
+}
+
+double Scorer::get_partial_unit_log_cond_prob(PathTrie* prefix, ScoreCache* cache)
+{
+  if (prefix->is_empty()) {
+    return 0.0;
+  }
+
+  PathTrie* previous = get_prev_unit(prefix, cache);
+
+  // the unit is made of the labels after previous, and need not be complete
+  // nor in the dictionary
+  std::vector<int> labels;
+  for (PathTrie* node = prefix; node != previous; node = node->parent) {
+    labels.push_back(node->character);
+  }
+  std::reverse(labels.begin(), labels.end());
+  lm::WordIndex word_index = language_model_->BaseVocabulary().Index(alphabet_.LabelsToString(labels));
+
+  lm::ngram::State out_state;
+  int units_since_oov;
+  return score_word(previous, word_index, &out_state, &units_since_oov, cache);
+}
+
+PathTrie* Scorer::get_prev_unit(PathTrie* prefix, ScoreCache* cache)
+{
+  // node holding the state after the previous unit, found the same way as
+  // get_prev_grapheme and get_prev_word do
+  PathTrie* previous = prefix;
+  if (is_utf8_mode_) {
+    while (!previous->is_empty() && !byte_is_codepoint_boundary(previous->character + 1)) {
+      previous = previous->parent;
+    }
+    if (!previous->is_empty()) {
+      previous = previous->parent;
+    }
+  } else {
+    while (!previous->is_empty() && previous->character != SPACE_ID_) {
+      previous = previous->parent;
+    }
+  }
+
+  if (!previous->is_empty() && !previous->has_lm_state) {
+    get_prefix_log_cond_prob(is_utf8_mode_ ? previous : previous->parent, previous, cache);
+  }
+  return previous;
+}
+
+void Scorer::score_unit(PathTrie* previous, PathTrie* boundary, ScoreCache* cache)
+{
+  // the dictionary identified the word when it reached its final state
+  boundary->reserve_lm_state();
+  PathTrieLmState* lm = boundary->lm;
+  lm->score = score_word(previous,
+                         boundary->word_index,
+                         &lm->state,
+                         &lm->units_since_oov,
+                         cache);
+  boundary->has_lm_state = true;
+}
+
+double Scorer::score_word(PathTrie* previous,
+                          lm::WordIndex word,
+                          lm::ngram::State* out_state,
+                          int* units_since_oov,
+                          ScoreCache* cache)
+{
+  // language model state after the previous unit
+  const int max_order = max_order_;
+  const lm::ngram::State* in_state = &begin_state_;
+  int since_oov = max_order;
+  if (!previous->is_empty()) {
+    in_state = &previous->lm->state;
+    since_oov = previous->lm->units_since_oov;
+  }
+
+  float log10_prob;
+  if (cache == nullptr || !cache->find(*in_state, word, &log10_prob, out_state)) {
+    log10_prob = language_model_->BaseScore(in_state, word, out_state);
+    if (cache != nullptr) {
+      cache->insert(*in_state, word, log10_prob, *out_state);
+    }
+  }
+  double cond_prob = log10_prob;
+
+  // like the ngram based scoring, any out of vocabulary unit among the last
+  // max_order ones gives OOV_SCORE
+  if (word == lm::kUNK) {
+    since_oov = 0;
+  } else if (since_oov < max_order) {
+    ++since_oov;
+  }
+  *units_since_oov = since_oov;
+  if (since_oov < max_order) {
+    return OOV_SCORE;
+  }
+  // loge prob
+  return cond_prob/NUM_FLT_LOGE;
+}
+
 void Scorer::reset_params(float alpha, float beta)
 {
   this->alpha = alpha;
@@ -318,39 +565,74 @@ std::vector<std::string> Scorer::make_ngram(PathTrie* prefix)
 
 void Scorer::fill_dictionary(const std::vector<std::string>& vocabulary)
 {
-  // ConstFst is immutable, so we need to use a MutableFst to create the trie,
-  // and then we convert to a ConstFst for the decoder and for storing on disk.
-  fst::StdVectorFst dictionary;
-  // For each unigram convert to ints and put in trie
-  for (const auto& word : vocabulary) {
-    if (word != START_TOKEN && word != UNK_TOKEN && word != END_TOKEN) {
-      add_word_to_dictionary(word, char_map_, is_utf8_mode_, SPACE_ID_ + 1, &dictionary);
+  using Word = std::pair<std::vector<int>, lm::WordIndex>;
+  const auto& vocab = language_model_->BaseVocabulary();
+  // Spelling and merging each take half of the progress bar
+  util::ErsatzProgress progress(2 * vocabulary.size(), dictionary_progress,
+                                "Building the dictionary");
+
+  // Spell the words with the alphabet in parallel, each task sorting its
+  // share of the vocabulary
+  const size_t num_shares = (vocabulary.size() + DICTIONARY_SHARE_SIZE - 1) / DICTIONARY_SHARE_SIZE;
+  std::vector<std::vector<Word>> shares(num_shares);
+  {
+    ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::future<void>> tasks;
+    for (size_t i = 0; i < num_shares; ++i) {
+      tasks.emplace_back(pool.enqueue([this, &vocabulary, &vocab, &shares, i] {
+        std::vector<Word>& share = shares[i];
+        std::vector<int> labels;
+        const size_t end = std::min(vocabulary.size(), (i + 1) * DICTIONARY_SHARE_SIZE);
+        for (size_t j = i * DICTIONARY_SHARE_SIZE; j < end; ++j) {
+          const std::string& word = vocabulary[j];
+          if (word != START_TOKEN && word != UNK_TOKEN && word != END_TOKEN &&
+              get_dictionary_labels(word, char_map_, is_utf8_mode_, SPACE_ID_ + 1, &labels)) {
+            share.emplace_back(labels, vocab.Index(word));
+          }
+        }
+        std::sort(share.begin(), share.end());
+      }));
+    }
+    for (size_t i = 0; i < num_shares; ++i) {
+      tasks[i].get();
+      progress += std::min(vocabulary.size() - i * DICTIONARY_SHARE_SIZE, DICTIONARY_SHARE_SIZE);
+    }
+  }
+
+  // Merge the shares into the dictionary, in order
+  std::vector<size_t> positions(num_shares, 0);
+  auto after = [&shares, &positions](size_t a, size_t b) {
+    return shares[b][positions[b]] < shares[a][positions[a]];
+  };
+  std::priority_queue<size_t, std::vector<size_t>, decltype(after)> next(after);
+  // Only the words that could be spelled are merged
+  uint64_t num_spelled = 0;
+  for (size_t i = 0; i < num_shares; ++i) {
+    num_spelled += shares[i].size();
+    if (!shares[i].empty()) {
+      next.push(i);
     }
   }
 
-  /* Simplify FST
-
-   * This gets rid of "epsilon" transitions in the FST.
-   * These are transitions that don't require a string input to be taken.
-   * Getting rid of them is necessary to make the FST deterministic, but
-   * can greatly increase the size of the FST
-   */
-  fst::RmEpsilon(&dictionary);
-  std::unique_ptr<fst::StdVectorFst> new_dict(new fst::StdVectorFst);
-
-  /* This makes the FST deterministic, meaning for any string input there's
-   * only one possible state the FST could be in.  It is assumed our
-   * dictionary is deterministic when using it.
-   * (lest we'd have to check for multiple transitions at each state)
-   */
-  fst::Determinize(dictionary, new_dict.get());
-
-  /* Finds the simplest equivalent fst. This is unnecessary but decreases
-   * memory usage of the dictionary
-   */
-  fst::Minimize(new_dict.get());
-
-  // Now we convert the MutableFst to a ConstFst (Scorer::FstType) via its ctor
-  std::unique_ptr<FstType> converted(new FstType(*new_dict));
-  this->dictionary = std::move(converted);
+  DictionaryBuilder builder;
+  uint64_t num_merged = 0;
+  while (!next.empty()) {
+    const size_t i = next.top();
+    next.pop();
+    // Words can't be added twice, which the language model vocabulary does
+    // not have anyway
+    const Word& word = shares[i][positions[i]];
+    builder.add(word.first, word.second);
+    progress.Set(vocabulary.size() + ++num_merged * vocabulary.size() / num_spelled);
+    if (++positions[i] < shares[i].size()) {
+      next.push(i);
+    } else {
+      std::vector<Word>().swap(shares[i]);
+    }
+  }
+  progress.Finished();
+
+  fst::StdVectorFst dictionary;
+  builder.finish(&dictionary);
+  this->dictionary.reset(new TransitionTable(dictionary));
 }
@@ -2,17 +2,23 @@
 #define SCORER_H_
 
 #include <memory>
+#include <ostream>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "lm/enumerate_vocab.hh"
+#include "lm/state.hh"
 #include "lm/virtual_interface.hh"
 #include "lm/word_index.hh"
+#include "util/mmap.hh"
 #include "util/string_piece.hh"
 
 #include "path_trie.h"
 #include "alphabet.h"
+#include "score_cache.h"
+#include "transition_table.h"
 
 const double OOV_SCORE = -1000.0;
 const std::string START_TOKEN = "<s>";
@@ -40,7 +46,7 @@ public:
  *     scorer.get_sent_log_prob({ "WORD1", "WORD2", "WORD3" });
  */
 class Scorer {
-  using FstType = PathTrie::FstType;
+  using FstType = fst::ConstFst<fst::StdArc>;
 
 public:
   Scorer() = default;
@@ -73,6 +79,45 @@ public:
 
   double get_sent_log_prob(const std::vector<std::string> &words);
 
+  // return the conditional log probability of the unit (word or character)
+  // ending at prefix given the units before it, which is what
+  // get_log_cond_prob returns for the ngram made by make_ngram. The result
+  // and the language model state after the unit are kept on boundary, the
+  // node scored for this unit by the decoder. It is the next node in word
+  // based scoring and prefix itself otherwise. Each unit is thus scored once,
+  // starting from the state kept for the previous unit. Language model
+  // queries go through cache when one is given.
+  double get_prefix_log_cond_prob(PathTrie* prefix,
+                                  PathTrie* boundary,
+                                  ScoreCache* cache = nullptr);
+
+  // same as get_prefix_log_cond_prob for many (prefix, boundary) pairs at
+  // once, keeping the results on the boundaries. Lookups for the whole batch
+  // are started before any is scored, so that their cache misses overlap.
+  void score_prefixes(const std::vector<std::pair<PathTrie*, PathTrie*>>& prefixes,
+                      ScoreCache* cache = nullptr);
+
+  // score_prefixes in two parts, for the scoring to be split between
+  // threads. find_prev_units gets the node each unit is scored from, or null
+  // for units already scored, and starts the lookups. score_units then scores
+  // the units from begin to end, which can be done for separate ranges at the
+  // same time, with a cache per thread, as long as they share no boundary.
+  void find_prev_units(const std::vector<std::pair<PathTrie*, PathTrie*>>& prefixes,
+                       std::vector<PathTrie*>* previous,
+                       ScoreCache* cache = nullptr);
+  void score_units(const std::vector<std::pair<PathTrie*, PathTrie*>>& prefixes,
+                   const std::vector<PathTrie*>& previous,
+                   size_t begin,
+                   size_t end,
+                   ScoreCache* cache = nullptr);
+
+  // return the conditional log probability of the possibly incomplete unit
+  // ending at prefix, which is what get_log_cond_prob returns for the ngram
+  // made by make_ngram. Nothing is kept for the unit itself, but the states
+  // of the units before it are, as with get_prefix_log_cond_prob.
+  double get_partial_unit_log_cond_prob(PathTrie* prefix,
+                                        ScoreCache* cache = nullptr);
+
   // return the max order
   size_t get_max_order() const { return max_order_; }
 
@@ -89,8 +134,9 @@ public:
   // the vector of characters (character based lm)
   std::vector<std::string> split_labels_into_scored_units(const std::vector<int> &labels);
 
-  // save dictionary in file
-  void save_dictionary(const std::string &path);
+  // save dictionary in file, replacing it atomically if it exists. Returns 0
+  // on success
+  int save_dictionary(const std::string &path);
 
   // return weather this step represents a boundary where beam scoring should happen
   bool is_scoring_boundary(PathTrie* prefix, size_t new_label);
@@ -100,8 +146,11 @@ public:
   // word insertion weight
   double beta = 0.;
 
-  // pointer to the dictionary of FST
-  std::unique_ptr<FstType> dictionary;
+  // transitions of the dictionary, looked up by the decoder
+  std::unique_ptr<TransitionTable> dictionary;
+
+  // stream to report the progress of building the dictionary to, none if null
+  std::ostream* dictionary_progress = nullptr;
 
 protected:
   // necessary setup: load language model, fill FST's dictionary
@@ -113,10 +162,29 @@ protected:
   // fill dictionary for FST
   void fill_dictionary(const std::vector<std::string> &vocabulary);
 
+  // return the node holding the language model state the unit ending at
+  // prefix is scored from, computing that state if needed
+  PathTrie* get_prev_unit(PathTrie* prefix, ScoreCache* cache);
+
+  // score the unit ending at boundary from the state held by previous
+  void score_unit(PathTrie* previous, PathTrie* boundary, ScoreCache* cache);
+
+  // return the conditional log probability of word after the units up to
+  // previous, storing the state after it in out_state and updating
+  // units_since_oov from the value for previous
+  double score_word(PathTrie* previous,
+                    lm::WordIndex word,
+                    lm::ngram::State* out_state,
+                    int* units_since_oov,
+                    ScoreCache* cache);
+
 private:
   std::unique_ptr<lm::base::Model> language_model_;
+  // trie file the dictionary is used from, when loaded from one
+  util::scoped_memory dictionary_memory_;
   bool is_utf8_mode_ = true;
   size_t max_order_ = 0;
+  lm::ngram::State begin_state_;
 
   int SPACE_ID_;
   Alphabet alphabet_;
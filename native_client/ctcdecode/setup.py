@@ -58,9 +58,13 @@ decoder_module = Extension(
     name='ds_ctcdecoder._swigwrapper',
     sources=['swigwrapper.i',
              'ctc_beam_search_decoder.cpp',
+             'decoder_pool.cpp',
              'scorer.cpp',
              'path_trie.cpp',
-             'decoder_utils.cpp'],
+             'transition_table.cpp',
+             'decoder_utils.cpp',
+             'dictionary_builder.cpp',
+             'worker_group.cpp'],
     swig_opts=['-c++', '-extranative'],
     language='c++',
     include_dirs=INCLUDES + [numpy_include],
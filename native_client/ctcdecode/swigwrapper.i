@@ -2,6 +2,7 @@
 
 %{
 #include "ctc_beam_search_decoder.h"
+#include "decoder_pool.h"
 #define SWIG_FILE_WITH_INIT
 #define SWIG_PYTHON_STRICT_BYTE_CHAR
 %}
@@ -21,11 +22,23 @@ import_array();
 %apply (int* IN_ARRAY1, int DIM1) {(const int *seq_lengths, int seq_lengths_size)};
 
 %ignore Scorer::dictionary;
+%ignore Scorer::dictionary_progress;
+%ignore Scorer::score_prefixes;
+%ignore Scorer::find_prev_units;
+%ignore Scorer::score_units;
+
+// Let other Python threads run while waiting for decoded utterances
+%exception DecoderPool::next {
+  Py_BEGIN_ALLOW_THREADS
+  $action
+  Py_END_ALLOW_THREADS
+}
 
 %include "../alphabet.h"
 %include "output.h"
 %include "scorer.h"
 %include "ctc_beam_search_decoder.h"
+%include "decoder_pool.h"
 
 %template(IntVector) std::vector<int>;
 %template(OutputVector) std::vector<Output>;
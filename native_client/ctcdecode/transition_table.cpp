@@ -0,0 +1,198 @@
+#include "transition_table.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+size_t
+align(size_t size)
+{
+  return (size + 7) & ~static_cast<size_t>(7);
+}
+
+}  // namespace
+
+TransitionTable::TransitionTable(const fst::ExpandedFst<fst::StdArc>& fst)
+{
+  const auto FSTZERO = fst::TropicalWeight::Zero();
+  const int num_states = fst.NumStates();
+
+  std::vector<State> states(num_states + 1);
+  std::vector<std::uint8_t> finals(num_states);
+  std::vector<std::uint16_t> labels;
+  std::vector<Arc> arcs;
+  int max_label = 0;
+
+  std::vector<std::pair<int, Arc>> state_arcs;
+  for (int s = 0; s < num_states; ++s) {
+    state_arcs.clear();
+    for (fst::ArcIterator<fst::ExpandedFst<fst::StdArc>> it(fst, s); !it.Done(); it.Next()) {
+      const fst::StdArc& arc = it.Value();
+      state_arcs.push_back(std::make_pair(arc.ilabel, Arc{arc.nextstate, arc.olabel}));
+      max_label = std::max(max_label, arc.ilabel);
+    }
+    std::sort(state_arcs.begin(), state_arcs.end(),
+              [](const std::pair<int, Arc>& a, const std::pair<int, Arc>& b) {
+                return a.first < b.first;
+              });
+
+    states[s].first = labels.size();
+    states[s].dense_row = -1;
+    finals[s] = fst.Final(s) != FSTZERO;
+    for (const auto& arc : state_arcs) {
+      labels.push_back(arc.first);
+      arcs.push_back(arc.second);
+    }
+  }
+  states[num_states].first = labels.size();
+  states[num_states].dense_row = -1;
+
+  // Give dense rows to the states with the most arcs, now that the largest
+  // label is known
+  const int row_size = max_label + 1;
+  int num_dense = 0;
+  for (int s = 0; s < num_states; ++s) {
+    if ((states[s + 1].first - states[s].first) * DENSE_MIN_FILL >= row_size) {
+      states[s].dense_row = num_dense++;
+    }
+  }
+  std::vector<std::int32_t> dense(static_cast<size_t>(num_dense) * row_size, -1);
+  for (int s = 0; s < num_states; ++s) {
+    if (states[s].dense_row >= 0) {
+      std::int32_t* row = &dense[static_cast<size_t>(states[s].dense_row) * row_size];
+      for (std::uint32_t i = states[s].first; i < states[s + 1].first; ++i) {
+        row[labels[i]] = i;
+      }
+    }
+  }
+
+  // Lay everything out in a single block, as it is read back
+  Header header = {};
+  header.start = fst.Start();
+  header.max_label = max_label;
+  header.num_states = num_states;
+  header.num_arcs = labels.size();
+  header.num_dense = num_dense;
+
+  storage_.resize(align(sizeof(Header)) / sizeof(std::uint64_t));
+  std::memcpy(storage_.data(), &header, sizeof(Header));
+  storage_.resize(set_sections(reinterpret_cast<const char*>(storage_.data())) / sizeof(std::uint64_t));
+
+  const char* data = reinterpret_cast<const char*>(storage_.data());
+  set_sections(data);
+  std::memcpy(const_cast<State*>(states_), states.data(), states.size() * sizeof(State));
+  std::memcpy(const_cast<std::uint8_t*>(finals_), finals.data(), finals.size());
+  std::memcpy(const_cast<std::uint16_t*>(labels_), labels.data(), labels.size() * sizeof(std::uint16_t));
+  std::memcpy(const_cast<Arc*>(arcs_), arcs.data(), arcs.size() * sizeof(Arc));
+  std::memcpy(const_cast<std::int32_t*>(dense_), dense.data(), dense.size() * sizeof(std::int32_t));
+}
+
+TransitionTable::TransitionTable(const char* data, size_t size)
+{
+  if (size < sizeof(Header)) {
+    return;
+  }
+  const Header* header = reinterpret_cast<const Header*>(data);
+  if (header->max_label < 0 || header->max_label > 0xFFFF ||
+      header->num_dense > header->num_states ||
+      (header->num_states == 0 && header->start != fst::kNoStateId) ||
+      (header->num_states > 0 && (header->start < 0 ||
+                                  static_cast<std::uint32_t>(header->start) >= header->num_states))) {
+    return;
+  }
+  // Bound the section sizes by the data size before adding them up
+  const size_t row_size = static_cast<size_t>(header->max_label) + 1;
+  if (header->num_states >= size / sizeof(State) ||
+      header->num_arcs > size / sizeof(Arc) ||
+      header->num_dense > size / sizeof(std::int32_t) / row_size) {
+    return;
+  }
+  if (set_sections(data) > size || !check()) {
+    header_ = nullptr;
+    states_ = nullptr;
+    size_ = 0;
+  }
+}
+
+bool
+TransitionTable::check() const
+{
+  // Every index find() follows has to stay within its section, and arcs have
+  // to be sorted for the binary search
+  const std::uint32_t num_states = header_->num_states;
+  const std::uint32_t num_arcs = header_->num_arcs;
+  const size_t row_size = static_cast<size_t>(header_->max_label) + 1;
+
+  if (states_[0].first != 0 || states_[num_states].first != num_arcs) {
+    return false;
+  }
+  for (std::uint32_t s = 0; s < num_states; ++s) {
+    const std::uint32_t begin = states_[s].first;
+    const std::uint32_t end = states_[s + 1].first;
+    if (end < begin || end > num_arcs) {
+      return false;
+    }
+    if (states_[s].dense_row < -1 ||
+        (states_[s].dense_row >= 0 &&
+         static_cast<std::uint32_t>(states_[s].dense_row) >= header_->num_dense)) {
+      return false;
+    }
+    for (std::uint32_t i = begin; i < end; ++i) {
+      if (labels_[i] > header_->max_label || (i > begin && labels_[i] <= labels_[i - 1])) {
+        return false;
+      }
+    }
+  }
+  for (std::uint32_t i = 0; i < num_arcs; ++i) {
+    if (arcs_[i].next_state < 0 ||
+        static_cast<std::uint32_t>(arcs_[i].next_state) >= num_states) {
+      return false;
+    }
+  }
+  const size_t dense_size = header_->num_dense * row_size;
+  for (size_t i = 0; i < dense_size; ++i) {
+    if (dense_[i] < -1 || (dense_[i] >= 0 && static_cast<std::uint32_t>(dense_[i]) >= num_arcs)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t
+TransitionTable::set_sections(const char* data)
+{
+  header_ = reinterpret_cast<const Header*>(data);
+  size_t offset = align(sizeof(Header));
+  states_ = reinterpret_cast<const State*>(data + offset);
+  offset += align((static_cast<size_t>(header_->num_states) + 1) * sizeof(State));
+  finals_ = reinterpret_cast<const std::uint8_t*>(data + offset);
+  offset += align(header_->num_states);
+  labels_ = reinterpret_cast<const std::uint16_t*>(data + offset);
+  offset += align(static_cast<size_t>(header_->num_arcs) * sizeof(std::uint16_t));
+  arcs_ = reinterpret_cast<const Arc*>(data + offset);
+  offset += align(static_cast<size_t>(header_->num_arcs) * sizeof(Arc));
+  dense_ = reinterpret_cast<const std::int32_t*>(data + offset);
+  offset += align(static_cast<size_t>(header_->num_dense) * (header_->max_label + 1) * sizeof(std::int32_t));
+  size_ = offset;
+  return offset;
+}
+
+void
+TransitionTable::write(std::ostream& out) const
+{
+  out.write(reinterpret_cast<const char*>(header_), size_);
+}
+
+void
+TransitionTable::copy_data()
+{
+  if (!valid() || !storage_.empty()) {
+    return;
+  }
+  // Sections are all 8 bytes aligned, so is the size of the table
+  storage_.resize(size_ / sizeof(std::uint64_t));
+  std::memcpy(storage_.data(), header_, size_);
+  set_sections(reinterpret_cast<const char*>(storage_.data()));
+}
@@ -0,0 +1,144 @@
+#ifndef TRANSITION_TABLE_H_
+#define TRANSITION_TABLE_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "fst/fstlib.h"
+
+/* Transitions of the dictionary FST, laid out for the lookups the decoder
+ * does when extending prefixes: from a state, follow the arc for a label.
+ *
+ * States with many arcs get a dense row indexed by label, others keep their
+ * arcs sorted by label and are binary searched. Lookups are not virtual and
+ * the table is immutable once built, so all decoder states of a scorer share
+ * it without any matcher of their own.
+ *
+ * The table is a single block of memory, which is also how it is stored in
+ * trie files. It can thus be used in place from a memory mapped file, without
+ * copying or parsing anything.
+ */
+class TransitionTable {
+public:
+  using StateId = int;
+
+  // a row is dense when at least 1/DENSE_MIN_FILL of the labels have an arc
+  static const int DENSE_MIN_FILL = 4;
+
+  // Build the table of a deterministic and epsilon free FST, whose input
+  // labels are below 2^16
+  explicit TransitionTable(const fst::ExpandedFst<fst::StdArc>& fst);
+
+  // Use the table written by write() at data, which must be 8 bytes aligned
+  // and stay valid while the table is used. size is the number of bytes
+  // available there. Use valid() to check that they hold a table, all of
+  // whose states, arcs and dense rows are checked to be consistent.
+  TransitionTable(const char* data, size_t size);
+
+  // Disallow copying
+  TransitionTable(const TransitionTable&) = delete;
+  TransitionTable& operator=(const TransitionTable&) = delete;
+
+  bool valid() const { return states_ != nullptr; }
+
+  // write the table as it is laid out in memory
+  void write(std::ostream& out) const;
+
+  // Copy a table used in place into memory of its own, after which the data
+  // it was used from can be released. Must not be called during lookups.
+  void copy_data();
+
+  StateId start() const { return header_->start; }
+
+  int max_label() const { return header_->max_label; }
+
+  // whether state is final, fst::kNoStateId, the start of an empty table,
+  // being none
+  bool is_final(StateId state) const { return state >= 0 && finals_[state] != 0; }
+
+  // follow the arc for label from state, if any, giving its destination and
+  // output label. There is none from fst::kNoStateId, the start of an empty
+  // table.
+  bool find(StateId state, int label, StateId* next_state, int* olabel) const
+  {
+    if (state < 0) {
+      return false;
+    }
+    const State& row = states_[state];
+    std::int32_t position;
+    if (row.dense_row >= 0) {
+      if (label < 0 || label > header_->max_label) {
+        return false;
+      }
+      position = dense_[static_cast<size_t>(row.dense_row) * (header_->max_label + 1) + label];
+      if (position < 0) {
+        return false;
+      }
+    } else {
+      const std::uint16_t* begin = labels_ + row.first;
+      const std::uint16_t* end = labels_ + states_[state + 1].first;
+      const std::uint16_t* arc = std::lower_bound(begin, end, label);
+      if (arc == end || *arc != label) {
+        return false;
+      }
+      position = arc - labels_;
+    }
+    *next_state = arcs_[position].next_state;
+    *olabel = arcs_[position].olabel;
+    return true;
+  }
+
+  // number of bytes taken by the table
+  size_t size() const { return size_; }
+
+  // number of states with a dense row
+  size_t num_dense_states() const { return header_->num_dense; }
+
+private:
+  struct Header {
+    std::int32_t start;
+    std::int32_t max_label;
+    std::uint32_t num_states;
+    std::uint32_t num_arcs;
+    std::uint32_t num_dense;
+    std::uint32_t unused;
+  };
+
+  // The arcs of state s are at positions states_[s].first to
+  // states_[s + 1].first, the last state being a sentinel
+  struct State {
+    std::uint32_t first;
+    std::int32_t dense_row;
+  };
+
+  struct Arc {
+    std::int32_t next_state;
+    std::int32_t olabel;
+  };
+
+  // point the sections at the table starting at data, returning its size
+  size_t set_sections(const char* data);
+
+  // whether all the indices in the sections are within bounds
+  bool check() const;
+
+  // Storage of tables built from an FST, 8 bytes aligned
+  std::vector<std::uint64_t> storage_;
+  size_t size_ = 0;
+
+  // Sections of the table, each 8 bytes aligned
+  const Header* header_ = nullptr;
+  const State* states_ = nullptr;
+  const std::uint8_t* finals_ = nullptr;
+  // input labels of the arcs, sorted within each state, and the rest of the
+  // arcs at the same positions
+  const std::uint16_t* labels_ = nullptr;
+  const Arc* arcs_ = nullptr;
+  // dense rows of max_label + 1 arc positions, -1 where there is no arc
+  const std::int32_t* dense_ = nullptr;
+};
+
+#endif  // TRANSITION_TABLE_H_
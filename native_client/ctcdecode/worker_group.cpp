@@ -0,0 +1,73 @@
+#include "worker_group.h"
+
+#include "decoder_utils.h"
+
+WorkerGroup::WorkerGroup(size_t num_threads)
+  : task_(nullptr)
+  , generation_(0)
+  , running_(0)
+  , stop_(false)
+{
+  VALID_CHECK_GT(num_threads, 0, "num_threads must be positive!");
+  for (size_t i = 1; i < num_threads; ++i) {
+    threads_.emplace_back(&WorkerGroup::work, this, i);
+  }
+}
+
+WorkerGroup::~WorkerGroup()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  start_cv_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void
+WorkerGroup::run(const std::function<void(size_t)>& task)
+{
+  if (threads_.empty()) {
+    task(0);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task_ = &task;
+    running_ = threads_.size();
+    ++generation_;
+  }
+  start_cv_.notify_all();
+
+  task(0);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [this] { return running_ == 0; });
+  task_ = nullptr;
+}
+
+void
+WorkerGroup::work(size_t worker)
+{
+  size_t generation = 0;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    start_cv_.wait(lock, [this, generation] { return stop_ || generation_ != generation; });
+    if (stop_) {
+      return;
+    }
+    generation = generation_;
+    const std::function<void(size_t)>& task = *task_;
+    lock.unlock();
+
+    task(worker);
+
+    lock.lock();
+    if (--running_ == 0) {
+      done_cv_.notify_one();
+    }
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef WORKER_GROUP_H_
+#define WORKER_GROUP_H_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Threads running a task together, for steps of work too short to go through
+ * a queue. The calling thread is one of the workers, the others wait for the
+ * next task between runs.
+ */
+class WorkerGroup {
+public:
+  // num_threads counts the calling thread
+  explicit WorkerGroup(size_t num_threads);
+  ~WorkerGroup();
+
+  // Disallow copying
+  WorkerGroup(const WorkerGroup&) = delete;
+  WorkerGroup& operator=(const WorkerGroup&) = delete;
+
+  size_t size() const { return threads_.size() + 1; }
+
+  // Call task(worker) for each worker from 0 to size() - 1, worker 0 being
+  // the calling thread, and return once all calls returned
+  void run(const std::function<void(size_t)>& task);
+
+private:
+  void work(size_t worker);
+
+  std::mutex mutex_;
+  std::condition_variable start_cv_;
+  std::condition_variable done_cv_;
+  const std::function<void(size_t)>* task_;
+  // Number of runs started, which tells the threads a new one did
+  size_t generation_;
+  // Threads still running the task of the current run
+  size_t running_;
+  bool stop_;
+
+  std::vector<std::thread> threads_;
+};
+
+#endif  // WORKER_GROUP_H_
@@ -9,9 +9,18 @@
 #include <utility>
 #include <vector>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 #include "deepspeech.h"
 #include "alphabet.h"
+#include "batchscheduler.h"
 #include "modelstate.h"
+#include "ringbuffer.h"
+#include "threadaffinity.h"
 
 #include "workspace_status.h"
 
@@ -39,11 +48,15 @@ using std::vector;
 
    The streaming process uses three buffers that are fed eagerly as audio data
    is fed in. The buffers only hold the minimum amount of data needed to do a
-   step in the acoustic model. The three buffers which live in StreamingState
-   are:
+   step in the acoustic model, and are allocated once when the stream is
+   created. The audio and MFCC buffers are ring buffers, so that sliding their
+   window forward never moves data. The three buffers which live in
+   StreamingState are:
 
    - audio_buffer, used to buffer audio samples until there's enough data to
-     compute input features for a single window.
+     compute input features for at least a single window. When large amounts
+     of audio are fed at once, features for all the complete windows are
+     computed in one go.
 
    - mfcc_buffer, used to buffer input features until there's enough data for
      a single timestep. Remember there's overlap in the features, each timestep
@@ -52,26 +65,39 @@ using std::vector;
      frames per timestep.
 
    - batch_buffer, used to buffer timesteps until there's enough data to compute
-     a batch of n_steps.
+     a batch of n_steps. Streams created for offline transcription of a whole
+     buffer use larger batches when the model supports it, to reduce the per
+     run overhead of the acoustic model.
 
    Data flows through all three buffers as audio samples are fed via the public
    API. When audio_buffer is full, features are computed from it and pushed to
    mfcc_buffer. When mfcc_buffer is full, the timestep is copied to batch_buffer.
    When batch_buffer is full, we do a single step through the acoustic model
    and accumulate the intermediate decoding state in the DecoderState structure.
+   Unless the step is batched with other streams, runtimes that support it read
+   batch_buffer and the LSTM state in place, see ModelState::infer_in_place.
 
    When finishStream() is called, we return the corresponding transcription from
    the current decoder state.
 */
 struct StreamingState {
-  vector<float> audio_buffer_;
-  vector<float> mfcc_buffer_;
+  // Maximum number of feature windows computed from a single chunk of audio
+  static constexpr unsigned int MAX_BULK_WINDOWS = 256;
+  // Number of timesteps per batch of offline streams, for models with a
+  // dynamic time dimension
+  static constexpr unsigned int OFFLINE_N_STEPS = 512;
+
+  RingBuffer<float> audio_buffer_;
+  RingBuffer<float> mfcc_buffer_;
   vector<float> batch_buffer_;
+  vector<float> mfcc_frames_;
   vector<float> previous_state_c_;
   vector<float> previous_state_h_;
 
   ModelState* model_;
   DecoderState decoder_state_;
+  bool low_latency_;
+  unsigned int n_steps_;
 
   StreamingState();
   ~StreamingState();
@@ -82,14 +108,22 @@ struct StreamingState {
   char* finishStream();
   Metadata* finishStreamWithMetadata();
 
-  void processAudioWindow(const vector<float>& buf);
-  void processMfccWindow(const vector<float>& buf);
-  void pushMfccBuffer(const vector<float>& buf);
+  void processAudioWindow(const float* buf, unsigned int n_samples);
+  void processAudioWindows(const float* buf, unsigned int n_windows);
+  void processMfccWindow(const float* buf);
+  void pushMfccBuffer(const float* buf, unsigned int n_values);
   void addZeroMfccWindow();
-  void processBatch(const vector<float>& buf, unsigned int n_steps);
+  void processBatch(vector<float>& buf, unsigned int n_frames);
+  void inferAndDecode(vector<float>& buf,
+                      unsigned int n_frames,
+                      vector<float>& state_c,
+                      vector<float>& state_h,
+                      DecoderState& decoder_state);
 };
 
 StreamingState::StreamingState()
+  : low_latency_(false)
+  , n_steps_(0)
 {
 }
 
@@ -97,33 +131,65 @@ StreamingState::~StreamingState()
 {
 }
 
-template<typename T>
-void
-shift_buffer_left(vector<T>& buf, int shift_amount)
+// Convert i16 samples into f32, eight at a time when SIMD is available
+static void
+convert_samples(const short* in, float* out, unsigned int count)
 {
-  std::rotate(buf.begin(), buf.begin() + shift_amount, buf.end());
-  buf.resize(buf.size() - shift_amount);
+  const float multiplier = 1.0f / (1 << 15);
+  unsigned int i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+  const __m128 scale = _mm_set1_ps(multiplier);
+  for (; i + 8 <= count; i += 8) {
+    __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    // Sign-extend to i32 by interleaving then shifting back arithmetically
+    __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16);
+    __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16);
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(low), scale));
+    _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scale));
+  }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  for (; i + 8 <= count; i += 8) {
+    int16x8_t samples = vld1q_s16(in + i);
+    int32x4_t low = vmovl_s16(vget_low_s16(samples));
+    int32x4_t high = vmovl_s16(vget_high_s16(samples));
+    vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_s32(low), multiplier));
+    vst1q_f32(out + i + 4, vmulq_n_f32(vcvtq_f32_s32(high), multiplier));
+  }
+#endif
+  for (; i < count; ++i) {
+    out[i] = (float)in[i] * multiplier;
+  }
 }
 
 void
 StreamingState::feedAudioContent(const short* buffer,
                                  unsigned int buffer_size)
 {
-  // Consume all the data that was passed in, processing full buffers if needed
+  const unsigned int win_len = model_->audio_win_len_;
+  const unsigned int win_step = model_->audio_win_step_;
+
+  // Samples are converted through a small stack buffer before being queued
+  const unsigned int block_size = 512;
+  float converted[block_size];
+
+  // Consume all the data that was passed in, filling the audio buffer up to
+  // MAX_BULK_WINDOWS feature windows at a time
   while (buffer_size > 0) {
-    while (buffer_size > 0 && audio_buffer_.size() < model_->audio_win_len_) {
-      // Convert i16 sample into f32
-      float multiplier = 1.0f / (1 << 15);
-      audio_buffer_.push_back((float)(*buffer) * multiplier);
-      ++buffer;
-      --buffer_size;
+    const unsigned int chunk_size = std::min<unsigned int>(buffer_size, audio_buffer_.free_space());
+    for (unsigned int done = 0; done < chunk_size; done += block_size) {
+      const unsigned int count = std::min(block_size, chunk_size - done);
+      convert_samples(buffer + done, converted, count);
+      audio_buffer_.push(converted, count);
     }
-
-    // If the buffer is full, process and shift it
-    if (audio_buffer_.size() == model_->audio_win_len_) {
-      processAudioWindow(audio_buffer_);
-      // Shift data by one step
-      shift_buffer_left(audio_buffer_, model_->audio_win_step_);
+    buffer += chunk_size;
+    buffer_size -= chunk_size;
+
+    // Compute features for all the complete windows at once, then drop the
+    // samples that no window will need anymore
+    if (audio_buffer_.size() >= win_len) {
+      const unsigned int n_windows = 1 + (audio_buffer_.size() - win_len) / win_step;
+      processAudioWindows(audio_buffer_.data(), n_windows);
+      audio_buffer_.pop(n_windows * win_step);
     }
 
     // Repeat until buffer empty
@@ -133,7 +199,22 @@ StreamingState::feedAudioContent(const short* buffer,
 char*
 StreamingState::intermediateDecode()
 {
-  return model_->decode(decoder_state_);
+  if (!low_latency_ || batch_buffer_.empty()) {
+    return model_->decode(decoder_state_);
+  }
+
+  // Speculatively run the acoustic model on the partial batch, starting from
+  // copies of the LSTM and decoder states. The partial batch is processed
+  // again for real once it is complete, so final results are unaffected.
+  vector<float> state_c(previous_state_c_);
+  vector<float> state_h(previous_state_h_);
+  DecoderState decoder_state(decoder_state_);
+  inferAndDecode(batch_buffer_,
+                 batch_buffer_.size() / model_->mfcc_feats_per_timestep_,
+                 state_c,
+                 state_h,
+                 decoder_state);
+  return model_->decode(decoder_state);
 }
 
 char*
@@ -151,20 +232,28 @@ StreamingState::finishStreamWithMetadata()
 }
 
 void
-StreamingState::processAudioWindow(const vector<float>& buf)
+StreamingState::processAudioWindow(const float* buf, unsigned int n_samples)
 {
   // Compute MFCC features
-  vector<float> mfcc;
-  mfcc.reserve(model_->n_features_);
-  model_->compute_mfcc(buf, mfcc);
-  pushMfccBuffer(mfcc);
+  mfcc_frames_.clear();
+  model_->compute_mfcc(buf, n_samples, mfcc_frames_);
+  pushMfccBuffer(mfcc_frames_.data(), mfcc_frames_.size());
+}
+
+void
+StreamingState::processAudioWindows(const float* buf, unsigned int n_windows)
+{
+  // Compute MFCC features of all windows, then push them in one go
+  mfcc_frames_.clear();
+  model_->compute_mfcc_windows(buf, n_windows, mfcc_frames_);
+  pushMfccBuffer(mfcc_frames_.data(), mfcc_frames_.size());
 }
 
 void
 StreamingState::finalizeStream()
 {
   // Flush audio buffer
-  processAudioWindow(audio_buffer_);
+  processAudioWindow(audio_buffer_.data(), audio_buffer_.size());
 
   // Add empty mfcc vectors at end of sample
   for (int i = 0; i < model_->n_context_; ++i) {
@@ -181,84 +270,109 @@ void
 StreamingState::addZeroMfccWindow()
 {
   vector<float> zero_buffer(model_->n_features_, 0.f);
-  pushMfccBuffer(zero_buffer);
-}
-
-template<typename InputIt, typename OutputIt>
-InputIt
-copy_up_to_n(InputIt from_begin, InputIt from_end, OutputIt to_begin, int max_elems)
-{
-  int next_copy_amount = std::min<int>(std::distance(from_begin, from_end), max_elems);
-  std::copy_n(from_begin, next_copy_amount, to_begin);
-  return from_begin + next_copy_amount;
+  pushMfccBuffer(zero_buffer.data(), zero_buffer.size());
 }
 
 void
-StreamingState::pushMfccBuffer(const vector<float>& buf)
+StreamingState::pushMfccBuffer(const float* buf, unsigned int n_values)
 {
-  auto start = buf.begin();
-  auto end = buf.end();
-  while (start != end) {
+  while (n_values > 0) {
     // Copy from input buffer to mfcc_buffer, stopping if we have a full context window
-    start = copy_up_to_n(start, end, std::back_inserter(mfcc_buffer_),
-                         model_->mfcc_feats_per_timestep_ - mfcc_buffer_.size());
-    assert(mfcc_buffer_.size() <= model_->mfcc_feats_per_timestep_);
+    const unsigned int count = std::min<unsigned int>(n_values, mfcc_buffer_.free_space());
+    mfcc_buffer_.push(buf, count);
+    buf += count;
+    n_values -= count;
 
     // If we have a full context window
-    if (mfcc_buffer_.size() == model_->mfcc_feats_per_timestep_) {
-      processMfccWindow(mfcc_buffer_);
+    if (mfcc_buffer_.full()) {
+      processMfccWindow(mfcc_buffer_.data());
       // Shift data by one step of one mfcc feature vector
-      shift_buffer_left(mfcc_buffer_, model_->n_features_);
+      mfcc_buffer_.pop(model_->n_features_);
     }
   }
 }
 
 void
-StreamingState::processMfccWindow(const vector<float>& buf)
-{
-  auto start = buf.begin();
-  auto end = buf.end();
-  while (start != end) {
-    // Copy from input buffer to batch_buffer, stopping if we have a full batch
-    start = copy_up_to_n(start, end, std::back_inserter(batch_buffer_),
-                         model_->n_steps_ * model_->mfcc_feats_per_timestep_ - batch_buffer_.size());
-    assert(batch_buffer_.size() <= model_->n_steps_ * model_->mfcc_feats_per_timestep_);
-
-    // If we have a full batch
-    if (batch_buffer_.size() == model_->n_steps_ * model_->mfcc_feats_per_timestep_) {
-      processBatch(batch_buffer_, model_->n_steps_);
-      batch_buffer_.resize(0);
-    }
+StreamingState::processMfccWindow(const float* buf)
+{
+  // Batches hold a whole number of context windows
+  batch_buffer_.insert(batch_buffer_.end(), buf, buf + model_->mfcc_feats_per_timestep_);
+  assert(batch_buffer_.size() <= n_steps_ * model_->mfcc_feats_per_timestep_);
+
+  // If we have a full batch
+  if (batch_buffer_.size() == n_steps_ * model_->mfcc_feats_per_timestep_) {
+    processBatch(batch_buffer_, n_steps_);
+    batch_buffer_.resize(0);
   }
 }
 
 void
-StreamingState::processBatch(const vector<float>& buf, unsigned int n_steps)
+StreamingState::processBatch(vector<float>& buf, unsigned int n_frames)
+{
+  inferAndDecode(buf, n_frames, previous_state_c_, previous_state_h_, decoder_state_);
+}
+
+void
+StreamingState::inferAndDecode(vector<float>& buf,
+                               unsigned int n_frames,
+                               vector<float>& state_c,
+                               vector<float>& state_h,
+                               DecoderState& decoder_state)
 {
   vector<float> logits;
-  model_->infer(buf,
-                n_steps,
-                previous_state_c_,
-                previous_state_h_,
-                logits,
-                previous_state_c_,
-                previous_state_h_);
+  if (model_->batch_scheduler_ && n_steps_ == model_->n_steps_) {
+    model_->batch_scheduler_->infer(buf,
+                                    n_frames,
+                                    state_c,
+                                    state_h,
+                                    logits);
+  } else if (model_->in_place_infer_ && n_steps_ == model_->n_steps_) {
+    // The runtime reads a whole step from buf, so zero-pad it for the call
+    const size_t n_values = buf.size();
+    buf.resize(n_steps_ * model_->mfcc_feats_per_timestep_, 0.f);
+    model_->infer_in_place(buf.data(),
+                           n_frames,
+                           state_c.data(),
+                           state_h.data(),
+                           logits);
+    buf.resize(n_values);
+  } else {
+    // Models with a dynamic time dimension don't need padding to n_steps_
+    const unsigned int n_steps = model_->dynamic_steps_ ? n_frames : model_->n_steps_;
+    model_->infer(buf,
+                  n_steps,
+                  {n_frames},
+                  state_c,
+                  state_h,
+                  logits,
+                  state_c,
+                  state_h);
+  }
 
   const size_t num_classes = model_->alphabet_.GetSize() + 1; // +1 for blank
-  const int n_frames = logits.size() / (ModelState::BATCH_SIZE * num_classes);
+  const int n_decoded = std::min<size_t>(n_frames, logits.size() / num_classes);
 
   // Convert logits to double
-  vector<double> inputs(logits.begin(), logits.end());
+  vector<double> inputs(logits.begin(), logits.begin() + n_decoded * num_classes);
 
-  decoder_state_.next(inputs.data(),
-                      n_frames,
-                      num_classes);
+  decoder_state.next(inputs.data(),
+                     n_decoded,
+                     num_classes);
 }
 
 int
 DS_CreateModel(const char* aModelPath,
                unsigned int aBeamWidth,
                ModelState** retval)
+{
+  return DS_CreateModelWithOptions(aModelPath, aBeamWidth, nullptr, retval);
+}
+
+int
+DS_CreateModelWithOptions(const char* aModelPath,
+                          unsigned int aBeamWidth,
+                          const ModelOptions* aOptions,
+                          ModelState** retval)
 {
   *retval = nullptr;
 
@@ -282,7 +396,23 @@ DS_CreateModel(const char* aModelPath,
     return DS_ERR_FAIL_CREATE_MODEL;
   }
 
-  int err = model->init(aModelPath, aBeamWidth);
+  if (aOptions) {
+    if (aOptions->intra_op_threads < 0 || aOptions->inter_op_threads < 0) {
+      std::cerr << "Error: Number of threads can't be negative." << std::endl;
+      return DS_ERR_INVALID_ARGUMENT;
+    }
+    model->intra_op_threads_ = aOptions->intra_op_threads;
+    model->inter_op_threads_ = aOptions->inter_op_threads;
+    model->cpu_affinity_mask_ = aOptions->cpu_affinity_mask;
+    model->per_model_thread_pools_ = aOptions->per_model_thread_pools != 0;
+  }
+
+  int err;
+  {
+    // Runtime threads started while loading inherit the affinity
+    ScopedCpuAffinity affinity(model->cpu_affinity_mask_);
+    err = model->init(aModelPath, aBeamWidth);
+  }
   if (err != DS_ERR_OK) {
     return err;
   }
@@ -321,6 +451,57 @@ DS_EnableDecoderWithLM(ModelState* aCtx,
   return DS_ERR_OK;
 }
 
+int
+DS_SetBlankSkipThreshold(ModelState* aCtx,
+                         float aThreshold)
+{
+  if (!(aThreshold >= 0.f && aThreshold <= 1.f)) {
+    std::cerr << "Error: Blank skip threshold must be between 0 and 1." << std::endl;
+    return DS_ERR_INVALID_ARGUMENT;
+  }
+  aCtx->blank_skip_threshold_ = aThreshold;
+  return DS_ERR_OK;
+}
+
+int
+DS_SetDecoderThreads(ModelState* aCtx,
+                     unsigned int aNumThreads)
+{
+  if (aNumThreads == 0) {
+    std::cerr << "Error: Number of decoder threads must be at least one." << std::endl;
+    return DS_ERR_INVALID_ARGUMENT;
+  }
+  aCtx->decoder_threads_ = aNumThreads;
+  return DS_ERR_OK;
+}
+
+int
+DS_SetMaxConcurrency(ModelState* aCtx,
+                     unsigned int aMaxConcurrency)
+{
+  return aCtx->set_max_concurrency(aMaxConcurrency);
+}
+
+int
+DS_EnableBatching(ModelState* aCtx,
+                  unsigned int aMaxBatchSize,
+                  unsigned int aMaxWaitUs)
+{
+  if (aMaxBatchSize > aCtx->batch_size_) {
+    std::cerr << "Error: Maximum batch size (" << aMaxBatchSize << ") is "
+              << "larger than the batch size of the loaded model ("
+              << aCtx->batch_size_ << ")." << std::endl;
+    return DS_ERR_INVALID_ARGUMENT;
+  }
+
+  if (aMaxBatchSize <= 1) {
+    aCtx->batch_scheduler_.reset();
+  } else {
+    aCtx->batch_scheduler_.reset(new BatchScheduler(aCtx, aMaxBatchSize, aMaxWaitUs));
+  }
+  return DS_ERR_OK;
+}
+
 int
 DS_CreateStream(ModelState* aCtx,
                 StreamingState** retval)
@@ -333,10 +514,12 @@ DS_CreateStream(ModelState* aCtx,
     return DS_ERR_FAIL_CREATE_STREAM;
   }
 
-  ctx->audio_buffer_.reserve(aCtx->audio_win_len_);
-  ctx->mfcc_buffer_.reserve(aCtx->mfcc_feats_per_timestep_);
-  ctx->mfcc_buffer_.resize(aCtx->n_features_*aCtx->n_context_, 0.f);
+  ctx->audio_buffer_.init(aCtx->audio_win_len_ + (StreamingState::MAX_BULK_WINDOWS - 1) * aCtx->audio_win_step_);
+  ctx->mfcc_buffer_.init(aCtx->mfcc_feats_per_timestep_);
+  ctx->mfcc_buffer_.push_n(aCtx->n_features_*aCtx->n_context_, 0.f);
+  ctx->n_steps_ = aCtx->n_steps_;
   ctx->batch_buffer_.reserve(aCtx->n_steps_ * aCtx->mfcc_feats_per_timestep_);
+  ctx->mfcc_frames_.reserve(StreamingState::MAX_BULK_WINDOWS * aCtx->n_features_);
   ctx->previous_state_c_.resize(aCtx->state_size_, 0.f);
   ctx->previous_state_h_.resize(aCtx->state_size_, 0.f);
   ctx->model_ = aCtx;
@@ -348,7 +531,9 @@ DS_CreateStream(ModelState* aCtx,
                            aCtx->beam_width_,
                            cutoff_prob,
                            cutoff_top_n,
-                           aCtx->scorer_.get());
+                           aCtx->scorer_.get(),
+                           aCtx->blank_skip_threshold_,
+                           aCtx->decoder_threads_);
 
   *retval = ctx.release();
   return DS_ERR_OK;
@@ -362,6 +547,13 @@ DS_FeedAudioContent(StreamingState* aSctx,
   aSctx->feedAudioContent(aBuffer, aBufferSize);
 }
 
+void
+DS_SetStreamLowLatency(StreamingState* aSctx,
+                       int aEnabled)
+{
+  aSctx->low_latency_ = aEnabled != 0;
+}
+
 char*
 DS_IntermediateDecode(StreamingState* aSctx)
 {
@@ -394,6 +586,15 @@ CreateStreamAndFeedAudioContent(ModelState* aCtx,
   if (status != DS_ERR_OK) {
     return nullptr;
   }
+
+  // Latency doesn't matter when the whole audio is available, so run as many
+  // timesteps as possible at once if the model allows it
+  if (aCtx->dynamic_steps_) {
+    ctx->n_steps_ = aCtx->n_steps_ > StreamingState::OFFLINE_N_STEPS
+                    ? aCtx->n_steps_ : StreamingState::OFFLINE_N_STEPS;
+    ctx->batch_buffer_.reserve(ctx->n_steps_ * aCtx->mfcc_feats_per_timestep_);
+  }
+
   DS_FeedAudioContent(ctx, aBuffer, aBufferSize);
   return ctx;
 }
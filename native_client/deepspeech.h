@@ -48,6 +48,33 @@ typedef struct Metadata {
   double confidence;
 } Metadata;
 
+/**
+ * @brief Options for loading a model with {@link DS_CreateModelWithOptions()}.
+ *        A zero-initialized struct gives the default behavior.
+ */
+typedef struct ModelOptions {
+  /** Number of threads used to parallelize a single operation, 0 lets the
+   * runtime decide. With TF Lite, the number of threads of each interpreter,
+   * 4 by default.
+   */
+  int intra_op_threads;
+  /** Number of threads used to run independent operations in parallel, 0 lets
+   * the runtime decide. Only used by the TensorFlow runtime.
+   */
+  int inter_op_threads;
+  /** Mask of the CPUs the threads created by the runtime while loading the
+   * model are allowed to run on, bit i standing for CPU i. 0 leaves affinity
+   * unchanged. Only supported on Linux.
+   */
+  unsigned long long cpu_affinity_mask;
+  /** Non-zero to give the model its own thread pools. By default, models
+   * loaded with the TensorFlow runtime share process-wide thread pools, sized
+   * by the options of the first model loaded. TF Lite interpreters always
+   * have their own threads.
+   */
+  int per_model_thread_pools;
+} ModelOptions;
+
 enum DeepSpeech_Error_Codes
 {
     // OK
@@ -61,6 +88,7 @@ enum DeepSpeech_Error_Codes
     DS_ERR_INVALID_SHAPE      = 0x2001,
     DS_ERR_INVALID_LM         = 0x2002,
     DS_ERR_MODEL_INCOMPATIBLE = 0x2003,
+    DS_ERR_INVALID_ARGUMENT   = 0x2004,
 
     // Runtime failures
     DS_ERR_FAIL_INIT_MMAP     = 0x3000,
@@ -89,6 +117,26 @@ int DS_CreateModel(const char* aModelPath,
                    unsigned int aBeamWidth,
                    ModelState** retval);
 
+/**
+ * @brief Same as {@link DS_CreateModel()}, with control over how the inference
+ *        runtime uses threads.
+ *
+ * @param aModelPath The path to the frozen model graph.
+ * @param aBeamWidth The beam width used by the decoder. A larger beam
+ *                   width generates better results at the cost of decoding
+ *                   time.
+ * @param aOptions Threading options, NULL for the defaults.
+ * @param[out] retval a ModelState pointer
+ *
+ * @return Zero on success, non-zero on failure. DS_ERR_INVALID_ARGUMENT if
+ *         a number of threads is negative.
+ */
+DEEPSPEECH_EXPORT
+int DS_CreateModelWithOptions(const char* aModelPath,
+                              unsigned int aBeamWidth,
+                              const ModelOptions* aOptions,
+                              ModelState** retval);
+
 /**
  * @brief Return the sample rate expected by a model.
  *
@@ -126,6 +174,85 @@ int DS_EnableDecoderWithLM(ModelState* aCtx,
                            float aLMAlpha,
                            float aLMBeta);
 
+/**
+ * @brief Let the decoder skip the timesteps where the acoustic model is
+ *        confident that nothing is being said. When the probability of the
+ *        blank label at a timestep is above the threshold, the decoder only
+ *        updates the probabilities of its current candidate transcriptions
+ *        instead of extending them with every label, which also saves the
+ *        language model queries. This speeds decoding up, mostly on audio
+ *        with pauses, at a small cost in accuracy that grows as the
+ *        threshold decreases. Applies to streams created afterwards.
+ *        Disabled by default.
+ *
+ * @param aCtx The ModelState pointer for the model being changed.
+ * @param aThreshold Blank probability above which a timestep is skipped,
+ *                   between 0 and 1. A value of 1 disables skipping.
+ *
+ * @return Zero on success, non-zero on failure. DS_ERR_INVALID_ARGUMENT if
+ *         the threshold is not between 0 and 1.
+ */
+DEEPSPEECH_EXPORT
+int DS_SetBlankSkipThreshold(ModelState* aCtx,
+                             float aThreshold);
+
+/**
+ * @brief Set the number of threads each stream decodes with. The candidate
+ *        transcriptions of a timestep are extended and scored by the
+ *        language model in parallel, giving the same result as a single
+ *        thread. This speeds up the decoding of long audio with a wide beam
+ *        on otherwise idle cores. Applies to streams created afterwards.
+ *        Defaults to 1.
+ *
+ * @param aCtx The ModelState pointer for the model being changed.
+ * @param aNumThreads Number of threads per stream, at least 1.
+ *
+ * @return Zero on success, non-zero on failure (invalid arguments).
+ */
+DEEPSPEECH_EXPORT
+int DS_SetDecoderThreads(ModelState* aCtx,
+                         unsigned int aNumThreads);
+
+/**
+ * @brief Set the maximum number of streams sharing a model that can run the
+ *        acoustic model or feature computation at the same time. With the
+ *        TF Lite runtime, each concurrent call needs its own interpreter, and
+ *        interpreters are created on demand up to this limit. They all share
+ *        a single copy of the model weights. Calls beyond the limit wait for
+ *        an interpreter to become available. Defaults to the number of CPU
+ *        cores. Has no effect with the TensorFlow runtime, whose sessions
+ *        handle concurrent calls.
+ *
+ * @param aCtx The ModelState pointer for the model being changed.
+ * @param aMaxConcurrency Maximum number of concurrent calls, at least 1.
+ *
+ * @return Zero on success, non-zero on failure (invalid arguments).
+ */
+DEEPSPEECH_EXPORT
+int DS_SetMaxConcurrency(ModelState* aCtx,
+                         unsigned int aMaxConcurrency);
+
+/**
+ * @brief Enable dynamic batching of acoustic model inference across the
+ *        streams sharing a model. Steps that are ready on different streams
+ *        are run together in a single inference call, which requires a model
+ *        exported with a batch size larger than one (--export_batch_size).
+ *        Must not be called while streams created from this model are alive.
+ *
+ * @param aCtx The ModelState pointer for the model being changed.
+ * @param aMaxBatchSize Maximum number of streams processed by a single
+ *                      inference call, at most the batch size of the model.
+ *                      A value of 0 or 1 disables batching.
+ * @param aMaxWaitUs Maximum time in microseconds a ready step waits for other
+ *                   streams to fill the batch before being run.
+ *
+ * @return Zero on success, non-zero on failure (invalid arguments).
+ */
+DEEPSPEECH_EXPORT
+int DS_EnableBatching(ModelState* aCtx,
+                      unsigned int aMaxBatchSize,
+                      unsigned int aMaxWaitUs);
+
 /**
  * @brief Use the DeepSpeech model to perform Speech-To-Text.
  *
@@ -187,6 +314,23 @@ void DS_FeedAudioContent(StreamingState* aSctx,
                          const short* aBuffer,
                          unsigned int aBufferSize);
 
+/**
+ * @brief Enable or disable low latency intermediate results on a stream.
+ *        When enabled, {@link DS_IntermediateDecode()} also speculatively runs
+ *        the acoustic model on the audio that has not yet filled a complete
+ *        batch of timesteps, so that its results lag behind the fed audio by
+ *        a single timestep rather than up to a whole batch. This makes
+ *        intermediate decoding more expensive, but has no effect on the final
+ *        result. Disabled by default.
+ *
+ * @param aSctx A streaming state pointer returned by {@link DS_CreateStream()}.
+ * @param aEnabled Non-zero to enable low latency intermediate results, zero
+ *                 to disable them.
+ */
+DEEPSPEECH_EXPORT
+void DS_SetStreamLowLatency(StreamingState* aSctx,
+                            int aEnabled);
+
 /**
  * @brief Compute the intermediate decoding of an ongoing streaming inference.
  *
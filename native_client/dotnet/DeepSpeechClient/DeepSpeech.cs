@@ -97,6 +97,8 @@ namespace DeepSpeechClient
                     throw new ArgumentException("Error failed to create session.");
                 case ErrorCodes.DS_ERR_MODEL_INCOMPATIBLE:
                     throw new ArgumentException("Error incompatible model.");
+                case ErrorCodes.DS_ERR_INVALID_ARGUMENT:
+                    throw new ArgumentException("Invalid argument.");
                 default:
                     throw new ArgumentException("Unknown error, please make sure you are using the correct native binary.");
             }
@@ -16,6 +16,7 @@
         DS_ERR_INVALID_SHAPE = 0x2001,
         DS_ERR_INVALID_LM = 0x2002,
         DS_ERR_MODEL_INCOMPATIBLE = 0x2003,
+        DS_ERR_INVALID_ARGUMENT = 0x2004,
 
         // Runtime failures
         DS_ERR_FAIL_INIT_MMAP = 0x3000,
@@ -14,12 +14,12 @@ int generate_trie(const char* alphabet_path, const char* kenlm_path, const char*
     return err;
   }
   Scorer scorer;
+  scorer.dictionary_progress = &std::cerr;
   err = scorer.init(0.0, 0.0, kenlm_path, "", alphabet);
   if (err != 0) {
     return err;
   }
-  scorer.save_dictionary(trie_path);
-  return 0;
+  return scorer.save_dictionary(trie_path);
 }
 
 int main(int argc, char** argv) {
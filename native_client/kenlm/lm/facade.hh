@@ -44,6 +44,15 @@ template <class Child, class StateT, class VocabularyT> class ModelFacade : publ
           *reinterpret_cast<State*>(out_state));
     }
 
+    // Default Prefetch function does nothing.  Model can override this.
+    void Prefetch(const State &/*in_state*/, const WordIndex /*new_word*/) const {}
+
+    void BasePrefetch(const void *in_state, const WordIndex new_word) const {
+      static_cast<const Child*>(this)->Prefetch(
+          *reinterpret_cast<const State*>(in_state),
+          new_word);
+    }
+
     const State &BeginSentenceState() const { return begin_sentence_; }
     const State &NullContextState() const { return null_context_; }
     const Vocabulary &GetVocabulary() const { return *static_cast<const Vocabulary*>(&BaseVocabulary()); }
@@ -118,6 +118,20 @@ template <class Value> class HashedSearch {
       return ret;
     }
 
+    // Hint that an n-gram ending with word will soon be looked up.  Hashes of
+    // the n-grams depend only on their words, so all orders can be prefetched.
+    void Prefetch(WordIndex word, const WordIndex *context_rbegin, const WordIndex *context_rend) const {
+      util::Prefetch(&unigram_.Lookup(word));
+      Node node = static_cast<Node>(word);
+      const WordIndex *i = context_rbegin;
+      for (std::size_t order_minus_2 = 0; order_minus_2 < middle_.size(); ++order_minus_2, ++i) {
+        if (i == context_rend) return;
+        node = CombineWordHash(node, *i);
+        middle_[order_minus_2].Prefetch(node);
+      }
+      if (i != context_rend) longest_.Prefetch(CombineWordHash(node, *i));
+    }
+
     LongestPointer LookupLongest(WordIndex word, const Node &node) const {
       // Sign bit is always on because longest n-grams do not extend left.
       typename Longest::ConstIterator found;
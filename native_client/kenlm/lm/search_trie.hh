@@ -74,6 +74,12 @@ template <class Quant, class Bhiksha> class TrieSearch {
       return ret;
     }
 
+    // Hint that an n-gram ending with word will soon be looked up.  Only the
+    // unigram can be prefetched, higher orders are found by searching.
+    void Prefetch(WordIndex word, const WordIndex * /*context_rbegin*/, const WordIndex * /*context_rend*/) const {
+      unigram_.Prefetch(word);
+    }
+
     MiddlePointer Unpack(uint64_t extend_pointer, unsigned char extend_length, Node &node) const {
       return MiddlePointer(quant_, extend_length - 2, middle_begin_[extend_length - 2].ReadEntry(extend_pointer, node));
     }
@@ -4,6 +4,7 @@
 #include "lm/weights.hh"
 #include "lm/word_index.hh"
 #include "util/bit_packing.hh"
+#include "util/prefetch.hh"
 
 #include <cstddef>
 
@@ -62,6 +63,10 @@ class Unigram {
       return unigram_;
     }
 
+    void Prefetch(WordIndex word) const {
+      util::Prefetch(unigram_ + word);
+    }
+
     UnigramPointer Find(WordIndex word, NodeRange &next) const {
       UnigramValue *val = unigram_ + word;
       next.begin = val->next;
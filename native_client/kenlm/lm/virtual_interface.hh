@@ -133,6 +133,11 @@ class Model {
     // Prefer to use FullScore.  The context words should be provided in reverse order.
     virtual FullScoreReturn BaseFullScoreForgotState(const WordIndex *context_rbegin, const WordIndex *context_rend, const WordIndex new_word, void *out_state) const = 0;
 
+    // Hint that BaseScore or BaseFullScore will soon be called with these
+    // arguments.  Issuing hints for several queries before scoring them lets
+    // their memory accesses overlap.
+    virtual void BasePrefetch(const void *in_state, const WordIndex new_word) const = 0;
+
     unsigned char Order() const { return order_; }
 
     const Vocabulary &BaseVocabulary() const { return *base_vocab_; }
@@ -0,0 +1,24 @@
+#ifndef UTIL_PREFETCH_H
+#define UTIL_PREFETCH_H
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
+
+namespace util {
+
+// Hint that the memory at address will soon be read.  Does nothing where the
+// compiler offers no way to say so.
+inline void Prefetch(const void *address) {
+#if defined(__GNUC__)
+  __builtin_prefetch(address);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  _mm_prefetch(static_cast<const char*>(address), _MM_HINT_T0);
+#else
+  (void)address;
+#endif
+}
+
+} // namespace util
+
+#endif // UTIL_PREFETCH_H
@@ -3,6 +3,7 @@
 
 #include "util/exception.hh"
 #include "util/mmap.hh"
+#include "util/prefetch.hh"
 
 #include <algorithm>
 #include <cstddef>
@@ -143,6 +144,11 @@ template <class EntryT, class HashT, class EqualT = std::equal_to<typename Entry
       return mod_.Ideal(begin_, hash_(key));
     }
 
+    // Hint that key will soon be looked up.
+    void Prefetch(const Key key) const {
+      util::Prefetch(Ideal(key));
+    }
+
     template <class T> MutableIterator Insert(const T &t) {
 #ifdef DEBUG
       assert(initialized_);
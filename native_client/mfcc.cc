@@ -0,0 +1,283 @@
+#include "mfcc.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+
+using std::complex;
+using std::vector;
+
+// Default attributes of TensorFlow's Mfcc op, used by the exported graph
+static const double kLowerFrequencyLimit = 20.0;
+static const double kUpperFrequencyLimit = 4000.0;
+static const int kFilterbankChannelCount = 40;
+static const double kFilterbankFloor = 1e-12;
+
+static double
+freq_to_mel(double freq)
+{
+  return 1127.0 * std::log1p(freq / 700.0);
+}
+
+static unsigned int
+next_power_of_two(unsigned int value)
+{
+  unsigned int result = 1;
+  while (result < value) {
+    result <<= 1;
+  }
+  return result;
+}
+
+int
+MfccExtractor::init(unsigned int sample_rate,
+                    unsigned int window_length,
+                    unsigned int coefficient_count)
+{
+  if (sample_rate == 0 || window_length < 2 ||
+      coefficient_count == 0 || coefficient_count > kFilterbankChannelCount ||
+      kUpperFrequencyLimit > sample_rate / 2.0) {
+    return 1;
+  }
+
+  const double pi = std::atan(1) * 4;
+
+  window_length_ = window_length;
+  fft_length_ = next_power_of_two(window_length);
+  coefficient_count_ = coefficient_count;
+
+  window_.resize(window_length_);
+  for (unsigned int i = 0; i < window_length_; ++i) {
+    window_[i] = 0.5 - 0.5 * std::cos((2 * pi * i) / window_length_);
+  }
+
+  // FFT tables
+  const unsigned int half_length = fft_length_ / 2;
+  unsigned int log2_half_length = 0;
+  while ((1u << log2_half_length) < half_length) {
+    ++log2_half_length;
+  }
+  bit_reverse_.resize(half_length);
+  for (unsigned int i = 0; i < half_length; ++i) {
+    unsigned int reversed = 0;
+    for (unsigned int bit = 0; bit < log2_half_length; ++bit) {
+      reversed |= ((i >> bit) & 1) << (log2_half_length - 1 - bit);
+    }
+    bit_reverse_[i] = reversed;
+  }
+  twiddles_re_.resize(std::max(half_length, 1u) - 1);
+  twiddles_im_.resize(twiddles_re_.size());
+  for (unsigned int half = 1; half < half_length; half <<= 1) {
+    const unsigned int stride = half_length / (2 * half);
+    for (unsigned int j = 0; j < half; ++j) {
+      const complex<double> twiddle = std::polar(1.0, -2 * pi * (j * stride) / half_length);
+      twiddles_re_[half - 1 + j] = twiddle.real();
+      twiddles_im_[half - 1 + j] = twiddle.imag();
+    }
+  }
+  split_twiddles_re_.resize(half_length + 1);
+  split_twiddles_im_.resize(half_length + 1);
+  for (unsigned int i = 0; i <= half_length; ++i) {
+    const complex<double> twiddle = std::polar(1.0, -2 * pi * i / fft_length_);
+    split_twiddles_re_[i] = twiddle.real();
+    split_twiddles_im_[i] = twiddle.imag();
+  }
+
+  // Mel filterbank, see tensorflow/core/kernels/mfcc_mel_filterbank.cc
+  const int input_length = half_length + 1;
+  filterbank_channel_count_ = kFilterbankChannelCount;
+
+  // An extra center frequency is computed at the top to get the upper limit
+  // on the high side of the final triangular filter.
+  vector<double> center_frequencies(filterbank_channel_count_ + 1);
+  const double mel_low = freq_to_mel(kLowerFrequencyLimit);
+  const double mel_high = freq_to_mel(kUpperFrequencyLimit);
+  const double mel_spacing = (mel_high - mel_low) / (filterbank_channel_count_ + 1);
+  for (int i = 0; i < filterbank_channel_count_ + 1; ++i) {
+    center_frequencies[i] = mel_low + (mel_spacing * (i + 1));
+  }
+
+  // Always exclude DC
+  const double hz_per_sbin = 0.5 * sample_rate / (input_length - 1);
+  start_index_ = static_cast<int>(1.5 + (kLowerFrequencyLimit / hz_per_sbin));
+  end_index_ = static_cast<int>(kUpperFrequencyLimit / hz_per_sbin);
+
+  // Each bin contributes a weight to the channel it maps to, the downward
+  // slope of its triangle, and one minus that weight to the next channel, the
+  // upward slope. Bins map to channels in increasing order, so the bins of a
+  // channel are contiguous and each channel sums them in increasing order.
+  vector<vector<double>> channel_weights(filterbank_channel_count_);
+  band_start_.assign(filterbank_channel_count_, start_index_);
+  int channel = 0;
+  for (int i = start_index_; i <= end_index_ && i < input_length; ++i) {
+    const double melf = freq_to_mel(i * hz_per_sbin);
+    while (center_frequencies[channel] < melf && channel < filterbank_channel_count_) {
+      ++channel;
+    }
+    const int band = channel - 1; // Can be -1
+
+    double weight;
+    if (band >= 0) {
+      weight = (center_frequencies[channel] - melf) /
+               (center_frequencies[channel] - center_frequencies[channel - 1]);
+    } else {
+      weight = (center_frequencies[0] - melf) /
+               (center_frequencies[0] - mel_low);
+    }
+
+    for (int c : {band, band + 1}) {
+      if (c < 0 || c >= filterbank_channel_count_) {
+        continue;
+      }
+      if (channel_weights[c].empty()) {
+        band_start_[c] = i;
+      }
+      channel_weights[c].push_back(c == band ? weight : 1.0 - weight);
+    }
+  }
+  band_length_.resize(filterbank_channel_count_);
+  band_offset_.resize(filterbank_channel_count_);
+  band_weights_.clear();
+  for (int c = 0; c < filterbank_channel_count_; ++c) {
+    band_length_[c] = channel_weights[c].size();
+    band_offset_[c] = band_weights_.size();
+    band_weights_.insert(band_weights_.end(), channel_weights[c].begin(), channel_weights[c].end());
+  }
+
+  // DCT, see tensorflow/core/kernels/mfcc_dct.cc
+  const double fnorm = std::sqrt(2.0 / filterbank_channel_count_);
+  const double arg = pi / filterbank_channel_count_;
+  cosines_.resize(coefficient_count_ * filterbank_channel_count_);
+  for (unsigned int i = 0; i < coefficient_count_; ++i) {
+    for (int j = 0; j < filterbank_channel_count_; ++j) {
+      cosines_[i * filterbank_channel_count_ + j] = fnorm * std::cos(i * arg * (j + 0.5));
+    }
+  }
+
+  return 0;
+}
+
+// Compute the squared magnitude of the FFT of the windowed samples, for the
+// fft_length_/2 + 1 non-redundant frequency bins.
+void
+MfccExtractor::power_spectrum(const float* samples,
+                              unsigned int n_samples,
+                              vector<double>& fft_re,
+                              vector<double>& fft_im,
+                              vector<double>& spectrum) const
+{
+  const unsigned int half_length = fft_length_ / 2;
+  const unsigned int n_windowed = std::min(n_samples, window_length_);
+
+  // Pack even samples in the real part and odd samples in the imaginary part
+  // of a half length complex sequence, in bit reversed order.
+  fft_re.resize(half_length);
+  fft_im.resize(half_length);
+  for (unsigned int i = 0; i < half_length; ++i) {
+    const unsigned int even = 2 * i;
+    const unsigned int odd = 2 * i + 1;
+    fft_re[bit_reverse_[i]] = even < n_windowed ? samples[even] * window_[even] : 0.0;
+    fft_im[bit_reverse_[i]] = odd < n_windowed ? samples[odd] * window_[odd] : 0.0;
+  }
+
+  // Iterative radix-2 decimation in time. The first stage has a twiddle of
+  // 1, the others an even number of butterflies per block, written two at a
+  // time so that the compiler runs the pair as vector operations. Both halves
+  // are loaded before either is stored, so the pair doesn't alias.
+  double* const re = fft_re.data();
+  double* const im = fft_im.data();
+  for (unsigned int start = 0; start + 1 < half_length; start += 2) {
+    const double u_re = re[start];
+    const double u_im = im[start];
+    re[start] = u_re + re[start + 1];
+    im[start] = u_im + im[start + 1];
+    re[start + 1] = u_re - re[start + 1];
+    im[start + 1] = u_im - im[start + 1];
+  }
+  for (unsigned int half = 2; half < half_length; half <<= 1) {
+    const double* const w_re = &twiddles_re_[half - 1];
+    const double* const w_im = &twiddles_im_[half - 1];
+    for (unsigned int start = 0; start < half_length; start += 2 * half) {
+      double* const u_re = re + start;
+      double* const u_im = im + start;
+      double* const v_re = u_re + half;
+      double* const v_im = u_im + half;
+      for (unsigned int j = 0; j < half; j += 2) {
+        const double t_re0 = v_re[j] * w_re[j] - v_im[j] * w_im[j];
+        const double t_re1 = v_re[j + 1] * w_re[j + 1] - v_im[j + 1] * w_im[j + 1];
+        const double t_im0 = v_re[j] * w_im[j] + v_im[j] * w_re[j];
+        const double t_im1 = v_re[j + 1] * w_im[j + 1] + v_im[j + 1] * w_re[j + 1];
+        const double x_re0 = u_re[j];
+        const double x_re1 = u_re[j + 1];
+        const double x_im0 = u_im[j];
+        const double x_im1 = u_im[j + 1];
+        v_re[j] = x_re0 - t_re0;
+        v_re[j + 1] = x_re1 - t_re1;
+        v_im[j] = x_im0 - t_im0;
+        v_im[j + 1] = x_im1 - t_im1;
+        u_re[j] = x_re0 + t_re0;
+        u_re[j + 1] = x_re1 + t_re1;
+        u_im[j] = x_im0 + t_im0;
+        u_im[j + 1] = x_im1 + t_im1;
+      }
+    }
+  }
+
+  // Split step: recover the spectrum of the real sequence from z = fft[k]
+  // and the conjugate of fft[half_length - k], both taken modulo half_length
+  spectrum.resize(half_length + 1);
+  for (unsigned int k = 0; k <= half_length; ++k) {
+    const unsigned int mirror = (half_length - k) % half_length;
+    const double z_re = re[k % half_length];
+    const double z_im = im[k % half_length];
+    const double m_re = re[mirror];
+    const double m_im = -im[mirror];
+    const double even_re = 0.5 * (z_re + m_re);
+    const double even_im = 0.5 * (z_im + m_im);
+    const double odd_re = 0.5 * (z_im - m_im);
+    const double odd_im = -0.5 * (z_re - m_re);
+    const double x_re = even_re + (split_twiddles_re_[k] * odd_re - split_twiddles_im_[k] * odd_im);
+    const double x_im = even_im + (split_twiddles_re_[k] * odd_im + split_twiddles_im_[k] * odd_re);
+    spectrum[k] = x_re * x_re + x_im * x_im;
+  }
+}
+
+void
+MfccExtractor::compute(const float* samples,
+                       unsigned int n_samples,
+                       float* output) const
+{
+  // Scratch buffers are kept per thread so that steady state streaming does
+  // not allocate
+  thread_local vector<double> fft_re;
+  thread_local vector<double> fft_im;
+  thread_local vector<double> spectrum;
+  thread_local vector<double> filterbank;
+  power_spectrum(samples, n_samples, fft_re, fft_im, spectrum);
+
+  // Magnitudes of the bins, from the spectrogram the graph outputs as float
+  // before computing MFCCs
+  for (int i = start_index_; i <= end_index_; ++i) {
+    spectrum[i] = std::sqrt(static_cast<double>(static_cast<float>(spectrum[i])));
+  }
+
+  filterbank.resize(filterbank_channel_count_);
+  for (int c = 0; c < filterbank_channel_count_; ++c) {
+    const double* const magnitudes = &spectrum[band_start_[c]];
+    const double* const weights = &band_weights_[band_offset_[c]];
+    double sum = 0.0;
+    for (int i = 0; i < band_length_[c]; ++i) {
+      sum += weights[i] * magnitudes[i];
+    }
+    filterbank[c] = std::log(std::max(sum, kFilterbankFloor));
+  }
+
+  for (unsigned int i = 0; i < coefficient_count_; ++i) {
+    const double* row = &cosines_[i * filterbank_channel_count_];
+    double sum = 0.0;
+    for (int j = 0; j < filterbank_channel_count_; ++j) {
+      sum += row[j] * filterbank[j];
+    }
+    output[i] = static_cast<float>(sum);
+  }
+}
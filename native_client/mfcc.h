@@ -0,0 +1,94 @@
+#ifndef MFCC_H
+#define MFCC_H
+
+#include <vector>
+
+/*
+ * Native implementation of the feature computation subgraph of the exported
+ * model, which is made of TensorFlow's AudioSpectrogram (magnitude squared)
+ * and Mfcc ops with their default parameters. It computes MFCC features for
+ * one window of audio without going through the inference runtime.
+ *
+ * The math follows the TensorFlow kernels closely and is carried out in double
+ * precision like they do, so results match the graph output within float
+ * rounding.
+ */
+class MfccExtractor {
+public:
+  MfccExtractor() = default;
+  ~MfccExtractor() = default;
+
+  // Disallow copying
+  MfccExtractor(const MfccExtractor&) = delete;
+  MfccExtractor& operator=(const MfccExtractor&) = delete;
+
+  /**
+   * @brief Prepare the analysis window, FFT tables, mel filterbank and DCT.
+   *
+   * @param sample_rate Sample rate of the audio, in Hz.
+   * @param window_length Number of audio samples per window.
+   * @param coefficient_count Number of MFCC coefficients per window.
+   *
+   * @return Zero on success, non-zero if the configuration is not supported.
+   */
+  int init(unsigned int sample_rate,
+           unsigned int window_length,
+           unsigned int coefficient_count);
+
+  /**
+   * @brief Compute MFCC features for a single window of audio. Safe to call
+   *        concurrently from multiple threads.
+   *
+   * @param samples Audio samples of the window.
+   * @param n_samples Number of samples in @p samples. If shorter than the
+   *                  window length, missing samples are zero.
+   * @param[out] output Where to store the coefficient_count features.
+   */
+  void compute(const float* samples,
+               unsigned int n_samples,
+               float* output) const;
+
+  unsigned int window_length() const { return window_length_; }
+  unsigned int coefficient_count() const { return coefficient_count_; }
+
+private:
+  void power_spectrum(const float* samples,
+                      unsigned int n_samples,
+                      std::vector<double>& fft_re,
+                      std::vector<double>& fft_im,
+                      std::vector<double>& spectrum) const;
+
+  unsigned int window_length_ = 0;
+  unsigned int fft_length_ = 0;
+  unsigned int coefficient_count_ = 0;
+
+  // Periodic Hann window
+  std::vector<double> window_;
+
+  // Tables for a real FFT of fft_length_ points, computed as a complex FFT of
+  // fft_length_/2 points followed by a split step. Complex values are kept as
+  // separate real and imaginary arrays, and the twiddles of the stage of
+  // butterflies spanning 2*h points start at index h-1, so that each stage
+  // runs over contiguous arrays which the compiler vectorizes.
+  std::vector<unsigned int> bit_reverse_;
+  std::vector<double> twiddles_re_;
+  std::vector<double> twiddles_im_;
+  std::vector<double> split_twiddles_re_;
+  std::vector<double> split_twiddles_im_;
+
+  // Mel filterbank as a banded matrix: channel c weights the magnitudes of
+  // the band_length_[c] spectrum bins from band_start_[c] with the weights
+  // from band_weights_[band_offset_[c]]
+  int filterbank_channel_count_ = 0;
+  int start_index_ = 0;
+  int end_index_ = 0;
+  std::vector<int> band_start_;
+  std::vector<int> band_length_;
+  std::vector<int> band_offset_;
+  std::vector<double> band_weights_;
+
+  // DCT-II matrix, coefficient_count_ rows of filterbank_channel_count_ values
+  std::vector<double> cosines_;
+};
+
+#endif // MFCC_H
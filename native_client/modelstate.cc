@@ -1,13 +1,16 @@
+#include <algorithm>
 #include <vector>
 
 #include "ctcdecode/ctc_beam_search_decoder.h"
 
+#include "batchscheduler.h"
 #include "modelstate.h"
 
 using std::vector;
 
 ModelState::ModelState()
   : beam_width_(-1)
+  , batch_size_(-1)
   , n_steps_(-1)
   , n_context_(-1)
   , n_features_(-1)
@@ -16,6 +19,14 @@ ModelState::ModelState()
   , audio_win_len_(-1)
   , audio_win_step_(-1)
   , state_size_(-1)
+  , dynamic_steps_(false)
+  , in_place_infer_(false)
+  , intra_op_threads_(0)
+  , inter_op_threads_(0)
+  , cpu_affinity_mask_(0)
+  , per_model_thread_pools_(false)
+  , blank_skip_threshold_(1.f)
+  , decoder_threads_(1)
 {
 }
 
@@ -31,6 +42,87 @@ ModelState::init(const char* model_path,
   return DS_ERR_OK;
 }
 
+int
+ModelState::set_max_concurrency(unsigned int max_concurrency)
+{
+  return DS_ERR_OK;
+}
+
+void
+ModelState::infer_in_place(const float* mfcc,
+                           unsigned int n_frames,
+                           float* state_c,
+                           float* state_h,
+                           vector<float>& logits_output)
+{
+  vector<float> state_c_output;
+  vector<float> state_h_output;
+  infer(vector<float>(mfcc, mfcc + n_steps_ * mfcc_feats_per_timestep_),
+        n_steps_,
+        {n_frames},
+        vector<float>(state_c, state_c + state_size_),
+        vector<float>(state_h, state_h + state_size_),
+        logits_output,
+        state_c_output,
+        state_h_output);
+
+  if (state_c_output.size() < state_size_ || state_h_output.size() < state_size_) {
+    // Inference failed, error has already been reported by the model
+    return;
+  }
+  std::copy_n(state_c_output.begin(), state_size_, state_c);
+  std::copy_n(state_h_output.begin(), state_size_, state_h);
+}
+
+void
+ModelState::compute_mfcc(const float* audio_buffer,
+                         unsigned int n_samples,
+                         vector<float>& mfcc_output)
+{
+  if (!mfcc_extractor_) {
+    compute_mfcc_graph(vector<float>(audio_buffer, audio_buffer + n_samples), mfcc_output);
+    return;
+  }
+
+  const size_t offset = mfcc_output.size();
+  mfcc_output.resize(offset + n_features_);
+  mfcc_extractor_->compute(audio_buffer, n_samples, &mfcc_output[offset]);
+}
+
+void
+ModelState::compute_mfcc_windows(const float* audio_buffer,
+                                 unsigned int n_windows,
+                                 vector<float>& mfcc_output)
+{
+  if (!mfcc_extractor_) {
+    // The feature computation graph only handles a single window per run
+    vector<float> window(audio_win_len_);
+    for (unsigned int i = 0; i < n_windows; ++i) {
+      std::copy_n(audio_buffer + i * audio_win_step_, audio_win_len_, window.begin());
+      compute_mfcc_graph(window, mfcc_output);
+    }
+    return;
+  }
+
+  const size_t offset = mfcc_output.size();
+  mfcc_output.resize(offset + n_windows * n_features_);
+  for (unsigned int i = 0; i < n_windows; ++i) {
+    mfcc_extractor_->compute(audio_buffer + i * audio_win_step_,
+                             audio_win_len_,
+                             &mfcc_output[offset + i * n_features_]);
+  }
+}
+
+void
+ModelState::init_native_mfcc()
+{
+  std::unique_ptr<MfccExtractor> extractor(new MfccExtractor());
+  if (extractor->init(sample_rate_, audio_win_len_, n_features_) != 0) {
+    return;
+  }
+  mfcc_extractor_ = std::move(extractor);
+}
+
 char*
 ModelState::decode(const DecoderState& state)
 {
@@ -1,23 +1,26 @@
 #ifndef MODELSTATE_H
 #define MODELSTATE_H
 
+#include <memory>
 #include <vector>
 
 #include "deepspeech.h"
 #include "alphabet.h"
+#include "mfcc.h"
 
 #include "ctcdecode/scorer.h"
 #include "ctcdecode/output.h"
 
+class BatchScheduler;
 class DecoderState;
 
 struct ModelState {
-  //TODO: infer batch size from model/use dynamic batch size
-  static constexpr unsigned int BATCH_SIZE = 1;
-
   Alphabet alphabet_;
   std::unique_ptr<Scorer> scorer_;
+  std::unique_ptr<BatchScheduler> batch_scheduler_;
+  std::unique_ptr<MfccExtractor> mfcc_extractor_;
   unsigned int beam_width_;
+  unsigned int batch_size_;
   unsigned int n_steps_;
   unsigned int n_context_;
   unsigned int n_features_;
@@ -27,31 +30,139 @@ struct ModelState {
   unsigned int audio_win_step_;
   unsigned int state_size_;
 
+  // Whether infer() can run any number of timesteps at once. Otherwise, the
+  // time dimension is always n_steps_.
+  bool dynamic_steps_;
+
+  // Whether infer_in_place() reads its buffers without copying them, so that
+  // streams not batched by batch_scheduler_ should use it rather than infer()
+  bool in_place_infer_;
+
+  // Threading options of the inference runtime, see ModelOptions
+  unsigned int intra_op_threads_;
+  unsigned int inter_op_threads_;
+  unsigned long long cpu_affinity_mask_;
+  bool per_model_thread_pools_;
+
+  // Blank probability above which the decoder does not extend its beam, see
+  // DS_SetBlankSkipThreshold
+  float blank_skip_threshold_;
+  // Threads each stream decodes with, see DS_SetDecoderThreads
+  unsigned int decoder_threads_;
+
   ModelState();
   virtual ~ModelState();
 
   virtual int init(const char* model_path, unsigned int beam_width);
 
-  virtual void compute_mfcc(const std::vector<float>& audio_buffer, std::vector<float>& mfcc_output) = 0;
+  /**
+   * @brief Set the maximum number of inference runtime calls that can run
+   *        concurrently, for backends whose runtime state can't be shared
+   *        between threads.
+   *
+   * @return Zero on success, non-zero on failure.
+   */
+  virtual int set_max_concurrency(unsigned int max_concurrency);
+
+  /**
+   * @brief Compute MFCC features for a single window of audio, natively if
+   *        possible, otherwise by running the feature computation graph.
+   *
+   * @param audio_buffer Audio samples of the window.
+   * @param n_samples Number of samples in @p audio_buffer, missing samples
+   *                  of a window shorter than audio_win_len_ are zero.
+   *
+   * @param[out] mfcc_output Where to append the n_features_ computed features.
+   */
+  void compute_mfcc(const float* audio_buffer,
+                    unsigned int n_samples,
+                    std::vector<float>& mfcc_output);
+
+  /**
+   * @brief Compute MFCC features for consecutive windows of audio, starting
+   *        every audio_win_step_ samples.
+   *
+   * @param audio_buffer Audio samples, at least
+   *                     (n_windows-1)*audio_win_step_ + audio_win_len_ of them.
+   * @param n_windows Number of windows to compute features for.
+   *
+   * @param[out] mfcc_output Where to append the n_windows*n_features_ computed
+   *                         features.
+   */
+  void compute_mfcc_windows(const float* audio_buffer,
+                            unsigned int n_windows,
+                            std::vector<float>& mfcc_output);
+
+  /**
+   * @brief Compute MFCC features for a single window of audio by running the
+   *        feature computation subgraph of the model.
+   */
+  virtual void compute_mfcc_graph(const std::vector<float>& audio_buffer, std::vector<float>& mfcc_output) = 0;
+
+  /**
+   * @brief Set up the native MFCC feature extractor from the model metadata
+   *        (sample rate, window length and number of features). The feature
+   *        computation graph keeps being used for configurations it does not
+   *        support. test/mfcc_test.cc checks that both compute the same
+   *        features.
+   */
+  void init_native_mfcc();
 
   /**
    * @brief Do a single inference step in the acoustic model, with:
    *          input=mfcc
-   *          input_lengths=[n_frames]
+   *          input_lengths=n_frames
    *
-   * @param mfcc batch input data
-   * @param n_frames number of timesteps in the data
+   * @param mfcc batch input data, n_steps*mfcc_feats_per_timestep_ values
+   *             for each sequence in the batch. The data of the last sequence
+   *             can be shorter, missing values are zero-filled.
+   * @param n_steps time dimension of the batch. Must be n_steps_ unless
+   *                dynamic_steps_ is set.
+   * @param n_frames number of timesteps in the data of each sequence, at most
+   *                 batch_size_ sequences.
+   * @param previous_state_c LSTM cell state, state_size_ values per sequence.
+   * @param previous_state_h LSTM hidden state, state_size_ values per sequence.
    *
-   * @param[out] output_logits Where to store computed logits.
+   * @param[out] logits_output Where to store computed logits, n_steps frames
+   *                           per sequence, of which the first n_frames are
+   *                           valid.
+   * @param[out] state_c_output Where to store the new LSTM cell state.
+   * @param[out] state_h_output Where to store the new LSTM hidden state.
    */
   virtual void infer(const std::vector<float>& mfcc,
-                     unsigned int n_frames,
+                     unsigned int n_steps,
+                     const std::vector<unsigned int>& n_frames,
                      const std::vector<float>& previous_state_c,
                      const std::vector<float>& previous_state_h,
                      std::vector<float>& logits_output,
                      std::vector<float>& state_c_output,
                      std::vector<float>& state_h_output) = 0;
 
+  /**
+   * @brief Do a single inference step of n_steps_ timesteps for a single
+   *        sequence, like infer(), but with the runtime reading the input
+   *        features and LSTM state from the buffers of the caller instead of
+   *        copies of them. The default implementation copies them through
+   *        infer(), see in_place_infer_.
+   *
+   * @param mfcc input data, n_steps_*mfcc_feats_per_timestep_ values, of which
+   *             the first @p n_frames timesteps are valid. Must stay unchanged
+   *             during the call.
+   * @param n_frames number of valid timesteps in @p mfcc.
+   * @param[in,out] state_c LSTM cell state, state_size_ values, replaced with
+   *                        the new state.
+   * @param[in,out] state_h LSTM hidden state, state_size_ values, replaced
+   *                        with the new state.
+   *
+   * @param[out] logits_output Where to store computed logits, n_steps_ frames,
+   *                           of which the first @p n_frames are valid.
+   */
+  virtual void infer_in_place(const float* mfcc,
+                              unsigned int n_frames,
+                              float* state_c,
+                              float* state_h,
+                              std::vector<float>& logits_output);
+
   /**
    * @brief Perform decoding of the logits, using basic CTC decoder or
    *        CTC decoder with KenLM enabled
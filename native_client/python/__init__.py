@@ -22,6 +22,7 @@ import deepspeech
 # rename for backwards compatibility
 from deepspeech.impl import PrintVersions as printVersions
 from deepspeech.impl import FreeStream as freeStream
+from deepspeech.impl import ModelOptions
 
 class Model(object):
     """
@@ -32,12 +33,18 @@ class Model(object):
 
     :param aBeamWidth: Decoder beam width
     :type aBeamWidth: int
+
+    :param aOptions: Threading options of the inference runtime, optional
+    :type aOptions: :func:`ModelOptions`
     """
     def __init__(self,  *args, **kwargs):
         # make sure the attribute is there if CreateModel fails
         self._impl = None
 
-        status, impl = deepspeech.impl.CreateModel(*args, **kwargs)
+        if len(args) > 2 or 'aOptions' in kwargs:
+            status, impl = deepspeech.impl.CreateModelWithOptions(*args, **kwargs)
+        else:
+            status, impl = deepspeech.impl.CreateModel(*args, **kwargs)
         if status != 0:
             raise RuntimeError("CreateModel failed with error code {}".format(status))
         self._impl = impl
@@ -77,6 +84,61 @@ class Model(object):
         """
         return deepspeech.impl.EnableDecoderWithLM(self._impl, *args, **kwargs)
 
+    def setMaxConcurrency(self, *args, **kwargs):
+        """
+        Set the maximum number of streams sharing this model that can run inference at the same time.
+        With TF Lite, each concurrent call uses its own interpreter, all sharing the model weights.
+
+        :param aMaxConcurrency: Maximum number of concurrent calls, at least 1.
+        :type aMaxConcurrency: int
+
+        :return: Zero on success, non-zero on failure (invalid arguments).
+        :type: int
+        """
+        return deepspeech.impl.SetMaxConcurrency(self._impl, *args, **kwargs)
+
+    def setBlankSkipThreshold(self, *args, **kwargs):
+        """
+        Let the decoder skip the timesteps where the probability of blank is above a threshold,
+        only updating its current candidate transcriptions. Applies to streams created afterwards.
+
+        :param aThreshold: Blank probability above which a timestep is skipped, between 0 and 1. 1 disables skipping.
+        :type aThreshold: float
+
+        :return: Zero on success, non-zero on failure (invalid arguments).
+        :type: int
+        """
+        return deepspeech.impl.SetBlankSkipThreshold(self._impl, *args, **kwargs)
+
+    def setDecoderThreads(self, *args, **kwargs):
+        """
+        Set the number of threads each stream decodes with, giving the same result as a single one.
+        Applies to streams created afterwards.
+
+        :param aNumThreads: Number of threads per stream, at least 1.
+        :type aNumThreads: int
+
+        :return: Zero on success, non-zero on failure (invalid arguments).
+        :type: int
+        """
+        return deepspeech.impl.SetDecoderThreads(self._impl, *args, **kwargs)
+
+    def enableBatching(self, *args, **kwargs):
+        """
+        Enable dynamic batching of acoustic model inference across the streams sharing this model.
+        Requires a model exported with a batch size larger than one.
+
+        :param aMaxBatchSize: Maximum number of streams processed by a single inference call, 0 or 1 disables batching.
+        :type aMaxBatchSize: int
+
+        :param aMaxWaitUs: Maximum time in microseconds a ready step waits for other streams to fill the batch.
+        :type aMaxWaitUs: int
+
+        :return: Zero on success, non-zero on failure (invalid arguments).
+        :type: int
+        """
+        return deepspeech.impl.EnableBatching(self._impl, *args, **kwargs)
+
     def stt(self, *args, **kwargs):
         """
         Use the DeepSpeech model to perform Speech-To-Text.
@@ -137,6 +199,22 @@ class Model(object):
         """
         deepspeech.impl.FeedAudioContent(*args, **kwargs)
 
+    # pylint: disable=no-self-use
+    def setStreamLowLatency(self, *args, **kwargs):
+        """
+        Enable or disable low latency intermediate results on a stream. When
+        enabled, :func:`intermediateDecode()` also speculatively runs the
+        acoustic model on audio that has not yet filled a complete batch of
+        timesteps. This has no effect on the final result.
+
+        :param aSctx: A streaming state pointer returned by :func:`createStream()`.
+        :type aSctx: object
+
+        :param aEnabled: Whether to enable low latency intermediate results.
+        :type aEnabled: bool
+        """
+        deepspeech.impl.SetStreamLowLatency(*args, **kwargs)
+
     # pylint: disable=no-self-use
     def intermediateDecode(self, *args, **kwargs):
         """
@@ -0,0 +1,79 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+/*
+ * Fixed-capacity FIFO buffer whose content is always readable as a single
+ * contiguous array, without ever moving data around.
+ *
+ * Storage is twice the capacity, and every element is written both at its
+ * position in the ring and capacity elements further. Whatever the read
+ * position, the size() elements following it are then contiguous. Pushing
+ * and popping never allocate nor shift the buffered elements.
+ */
+template <typename T>
+class RingBuffer {
+public:
+  RingBuffer() = default;
+
+  void init(size_t capacity) {
+    data_.assign(2 * capacity, T());
+    capacity_ = capacity;
+    head_ = 0;
+    size_ = 0;
+  }
+
+  size_t capacity() const { return capacity_; }
+  size_t size() const { return size_; }
+  size_t free_space() const { return capacity_ - size_; }
+  bool empty() const { return size_ == 0; }
+  bool full() const { return size_ == capacity_; }
+
+  // Contiguous view of the size() buffered elements, oldest first
+  const T* data() const { return data_.data() + head_; }
+
+  // Append count elements, there must be enough free space for them
+  void push(const T* values, size_t count) {
+    assert(count <= free_space());
+    size_t tail = (head_ + size_) % capacity_;
+    size_t first = std::min(count, capacity_ - tail);
+    std::copy_n(values, first, data_.begin() + tail);
+    std::copy_n(values, first, data_.begin() + tail + capacity_);
+    std::copy_n(values + first, count - first, data_.begin());
+    std::copy_n(values + first, count - first, data_.begin() + capacity_);
+    size_ += count;
+  }
+
+  // Append count copies of value
+  void push_n(size_t count, const T& value) {
+    assert(count <= free_space());
+    for (size_t i = 0; i < count; ++i) {
+      size_t tail = (head_ + size_ + i) % capacity_;
+      data_[tail] = data_[tail + capacity_] = value;
+    }
+    size_ += count;
+  }
+
+  // Drop the count oldest elements
+  void pop(size_t count) {
+    assert(count <= size_);
+    head_ = (head_ + count) % capacity_;
+    size_ -= count;
+  }
+
+  void clear() {
+    head_ = 0;
+    size_ = 0;
+  }
+
+private:
+  std::vector<T> data_;
+  size_t capacity_ = 0;
+  size_t head_ = 0;
+  size_t size_ = 0;
+};
+
+#endif // RINGBUFFER_H
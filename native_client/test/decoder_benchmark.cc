@@ -0,0 +1,503 @@
+// Benchmark of the CTC beam search decoder on synthetic acoustic model
+// output, sweeping beam widths. Decodes take the same input every time, so
+// timings of different decoder versions can be compared directly. The word
+// and character error rates of the transcription against the spelled words
+// are reported with each timing. With a dictionary, lookups of its
+// transitions are timed on their own first.
+//
+// Usage: decoder_benchmark --alphabet=<alphabet.txt> [options]
+//   --beam_widths=256,512,1024  beam widths to decode with
+//   --frames=1500               time steps of the utterance
+//   --repeats=3                 decodes per configuration, the fastest counts
+//   --streams=1                 utterances decoded concurrently, by as many
+//                               threads
+//   --threads=1                 numbers of threads sharing the time steps of
+//                               each utterance, which pays off for beams of
+//                               1024 and more, e.g. --beam_widths=1024,2048
+//                               --threads=1,2,4
+//   --lm=<lm.binary>            language model to score with, also decoding
+//                               without it for comparison
+//   --trie=<trie>               dictionary of the language model
+//   --lm_alpha=0.75 --lm_beta=1.85
+//   --words=<file>              spell random words of this whitespace
+//                               separated list, for example the vocabulary of
+//                               the language model, instead of random letters
+//   --vocab_size=<n>            instead of --lm, score with a unigram model of
+//                               n random words, whose dictionary is built on
+//                               load, and spell those words. 500000 gives a
+//                               dictionary as large as those of big models.
+//   --blank_skip_thresholds=1   blank probabilities above which time steps
+//                               are skipped, 1 not skipping any
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "ctcdecode/ctc_beam_search_decoder.h"
+#include "ctcdecode/scorer.h"
+#include "ctcdecode/transition_table.h"
+#include "alphabet.h"
+
+using std::string;
+using std::vector;
+
+struct Options {
+  string alphabet;
+  vector<size_t> beam_widths = {256, 512, 1024};
+  int frames = 1500;
+  int repeats = 3;
+  int streams = 1;
+  vector<size_t> threads = {1};
+  string lm;
+  string trie;
+  double lm_alpha = 0.75;
+  double lm_beta = 1.85;
+  string words;
+  int vocab_size = 0;
+  vector<double> blank_skip_thresholds = {1.0};
+};
+
+static vector<size_t>
+parse_list(const string& value)
+{
+  vector<size_t> list;
+  std::istringstream in(value);
+  string item;
+  while (std::getline(in, item, ',')) {
+    list.push_back(std::stoul(item));
+  }
+  return list;
+}
+
+static vector<double>
+parse_double_list(const string& value)
+{
+  vector<double> list;
+  std::istringstream in(value);
+  string item;
+  while (std::getline(in, item, ',')) {
+    list.push_back(std::stod(item));
+  }
+  return list;
+}
+
+static bool
+parse_options(int argc, char** argv, Options* options)
+{
+  for (int i = 1; i < argc; ++i) {
+    const string arg(argv[i]);
+    const size_t equal = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || equal == string::npos) {
+      return false;
+    }
+    const string name = arg.substr(2, equal - 2);
+    const string value = arg.substr(equal + 1);
+    if (name == "alphabet") {
+      options->alphabet = value;
+    } else if (name == "beam_widths") {
+      options->beam_widths = parse_list(value);
+    } else if (name == "frames") {
+      options->frames = std::stoi(value);
+    } else if (name == "repeats") {
+      options->repeats = std::stoi(value);
+    } else if (name == "streams") {
+      options->streams = std::stoi(value);
+    } else if (name == "threads") {
+      options->threads = parse_list(value);
+    } else if (name == "lm") {
+      options->lm = value;
+    } else if (name == "trie") {
+      options->trie = value;
+    } else if (name == "lm_alpha") {
+      options->lm_alpha = std::stod(value);
+    } else if (name == "lm_beta") {
+      options->lm_beta = std::stod(value);
+    } else if (name == "words") {
+      options->words = value;
+    } else if (name == "vocab_size") {
+      options->vocab_size = std::stoi(value);
+    } else if (name == "blank_skip_thresholds") {
+      options->blank_skip_thresholds = parse_double_list(value);
+    } else {
+      return false;
+    }
+  }
+  for (double threshold : options->blank_skip_thresholds) {
+    if (threshold < 0) {
+      return false;
+    }
+  }
+  for (size_t num_threads : options->threads) {
+    if (num_threads == 0) {
+      return false;
+    }
+  }
+  return !options->alphabet.empty() && !options->beam_widths.empty() &&
+         !options->blank_skip_thresholds.empty() && !options->threads.empty() &&
+         (options->trie.empty() || !options->lm.empty()) &&
+         (options->vocab_size == 0 || (options->vocab_size > 0 &&
+                                       options->lm.empty() &&
+                                       options->words.empty())) &&
+         options->frames > 0 && options->repeats > 0 && options->streams > 0;
+}
+
+// Write an ARPA language model of vocab_size random words of English-like
+// letters and lengths, all equally likely, to a new temporary file whose path
+// is returned. The words are also written to words_path.
+static string
+write_random_lm(int vocab_size, const string& words_path)
+{
+  static const char letters[] = "abcdefghijklmnopqrstuvwxyz";
+  std::mt19937 rng(5);
+  std::discrete_distribution<int> letter({8.2, 1.5, 2.8, 4.3, 12.7, 2.2, 2.0, 6.1, 7.0, 0.2, 0.8, 4.0, 2.4,
+                                          6.7, 7.5, 1.9, 0.1, 6.0, 6.3, 9.1, 2.8, 1.0, 2.4, 0.2, 2.0, 0.1});
+  std::uniform_int_distribution<int> length(2, 12);
+  std::set<string> words;
+  while (words.size() < (size_t)vocab_size) {
+    string word;
+    for (int i = length(rng); i > 0; --i) {
+      word += letters[letter(rng)];
+    }
+    words.insert(word);
+  }
+
+  char path[] = "/tmp/decoder_benchmark_XXXXXX";
+  const int fd = mkstemp(path);
+  if (fd < 0) {
+    return "";
+  }
+  close(fd);
+
+  std::ofstream lm(path);
+  std::ofstream words_out(words_path);
+  lm << "\\data\\\n"
+     << "ngram 1=" << words.size() + 3 << "\n"
+     << "ngram 2=1\n\n"
+     << "\\1-grams:\n"
+     << "-1.0\t<unk>\t-0.5\n"
+     << "-99\t<s>\t-0.5\n"
+     << "-1.0\t</s>\t-0.5\n";
+  const double log10_prob = -std::log10((double)vocab_size);
+  for (const string& word : words) {
+    lm << log10_prob << "\t" << word << "\t-0.5\n";
+    words_out << word << "\n";
+  }
+  // KenLM only loads models of order 2 or more
+  lm << "\n\\2-grams:\n"
+     << "-1.0\t<s> " << *words.begin() << "\n\n"
+     << "\\end\\\n";
+  return path;
+}
+
+// Labels of the words of a file that can be spelled with the alphabet
+static vector<vector<int>>
+read_words(const Alphabet& alphabet, const string& path)
+{
+  vector<int> char_labels(256, -1);
+  for (size_t label = 0; label < alphabet.GetSize(); ++label) {
+    const string& str = alphabet.StringFromLabel(label);
+    if (str.size() == 1) {
+      char_labels[(unsigned char)str[0]] = label;
+    }
+  }
+
+  vector<vector<int>> words;
+  std::ifstream in(path);
+  string word;
+  while (in >> word) {
+    vector<int> labels;
+    for (char c : word) {
+      if (char_labels[(unsigned char)c] < 0) {
+        labels.clear();
+        break;
+      }
+      labels.push_back(char_labels[(unsigned char)c]);
+    }
+    if (!labels.empty()) {
+      words.push_back(labels);
+    }
+  }
+  return words;
+}
+
+// Softmax outputs that spell random words: each character is likely for two
+// frames followed by blanks, with some weight on a confusable character and
+// noise on all the others so that the beam fills up. Words are picked from
+// words if not empty, otherwise they are random letters. The labels spelled
+// are stored in reference.
+static vector<double>
+synthetic_probs(const Alphabet& alphabet, const vector<vector<int>>& words, int frames,
+                vector<int>* reference)
+{
+  const int num_classes = alphabet.GetSize() + 1;
+  const int blank = num_classes - 1;
+  const int space = alphabet.GetSpaceLabel();
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  std::uniform_int_distribution<int> word_length(2, 8);
+
+  vector<int> labels;
+  while (labels.size() < (size_t)frames) {
+    if (!labels.empty()) {
+      labels.push_back(space);
+    }
+    if (!words.empty()) {
+      const vector<int>& word = words[rng() % words.size()];
+      labels.insert(labels.end(), word.begin(), word.end());
+      continue;
+    }
+    for (int i = word_length(rng); i > 0; --i) {
+      int label;
+      do {
+        label = rng() % alphabet.GetSize();
+      } while (label == space);
+      labels.push_back(label);
+    }
+  }
+
+  reference->assign(labels.begin(), labels.begin() + (frames - 1) / 5 + 1);
+
+  vector<double> probs;
+  probs.reserve((size_t)frames * num_classes);
+  for (int t = 0; t < frames; ++t) {
+    const int label = labels[t / 5];
+    vector<double> frame(num_classes);
+    for (double& p : frame) {
+      p = 0.05 * uniform(rng);
+    }
+    if (t % 5 < 2) {
+      frame[label] += 0.5 + uniform(rng);
+    } else {
+      frame[blank] += 0.8 + 3 * uniform(rng);
+    }
+    frame[(label + 1) % alphabet.GetSize()] += 0.3 * uniform(rng);
+    double sum = 0;
+    for (double p : frame) {
+      sum += p;
+    }
+    for (double p : frame) {
+      probs.push_back(p / sum);
+    }
+  }
+  return probs;
+}
+
+// Levenshtein distance between two sequences
+template <typename T>
+static size_t
+edit_distance(const vector<T>& a, const vector<T>& b)
+{
+  vector<size_t> row(b.size() + 1);
+  for (size_t j = 0; j <= b.size(); ++j) {
+    row[j] = j;
+  }
+  for (size_t i = 1; i <= a.size(); ++i) {
+    size_t diagonal = row[0];
+    row[0] = i;
+    for (size_t j = 1; j <= b.size(); ++j) {
+      const size_t substitution = diagonal + (a[i - 1] == b[j - 1] ? 0 : 1);
+      diagonal = row[j];
+      row[j] = std::min(substitution, std::min(row[j], row[j - 1]) + 1);
+    }
+  }
+  return row[b.size()];
+}
+
+// Words of a sequence of labels, separated by spaces
+static vector<vector<int>>
+split_words(const vector<int>& labels, int space)
+{
+  vector<vector<int>> words(1);
+  for (int label : labels) {
+    if (label == space) {
+      words.emplace_back();
+    } else {
+      words.back().push_back(label);
+    }
+  }
+  words.erase(std::remove_if(words.begin(), words.end(),
+                             [](const vector<int>& word) { return word.empty(); }),
+              words.end());
+  return words;
+}
+
+// Time spelling words in the dictionary the way the decoder does: from each
+// state along a word, look up every label of the alphabet, then follow the
+// one of the word. Returns the fastest time of repeats in ms, and the number
+// of lookups in num_lookups.
+static double
+time_dictionary_lookups(const TransitionTable& dictionary,
+                        const vector<vector<int>>& words,
+                        size_t alphabet_size,
+                        int repeats,
+                        size_t* num_lookups)
+{
+  double best_ms = 0;
+  size_t found = 0;
+  for (int repeat = 0; repeat < repeats; ++repeat) {
+    *num_lookups = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const vector<int>& word : words) {
+      TransitionTable::StateId state = dictionary.start();
+      for (int label : word) {
+        TransitionTable::StateId next_state = state;
+        TransitionTable::StateId candidate;
+        int olabel;
+        for (size_t other = 0; other < alphabet_size; ++other) {
+          // labels of the dictionary are those of the alphabet plus one
+          if (dictionary.find(state, other + 1, &candidate, &olabel)) {
+            ++found;
+            if ((int)other == label) {
+              next_state = candidate;
+            }
+          }
+        }
+        *num_lookups += alphabet_size;
+        state = next_state;
+      }
+    }
+    auto end = std::chrono::steady_clock::now();
+    const double ms = std::chrono::duration<double, std::milli>(end - start).count();
+    if (repeat == 0 || ms < best_ms) {
+      best_ms = ms;
+    }
+  }
+  // keep the lookups from being optimized away
+  if (found == 0) {
+    std::cerr << "Warning: no word found in the dictionary" << std::endl;
+  }
+  return best_ms;
+}
+
+int
+main(int argc, char** argv)
+{
+  Options options;
+  if (!parse_options(argc, argv, &options)) {
+    std::cerr << "Usage: " << argv[0] << " --alphabet=<alphabet.txt> "
+              << "[--beam_widths=256,512,1024] [--frames=1500] [--repeats=3] "
+              << "[--streams=1] [--threads=1] [--lm=<lm.binary> --trie=<trie>] "
+              << "[--lm_alpha=0.75] [--lm_beta=1.85] [--words=<file>] "
+              << "[--vocab_size=<n>] [--blank_skip_thresholds=1]" << std::endl;
+    return 1;
+  }
+
+  Alphabet alphabet;
+  if (alphabet.init(options.alphabet.c_str()) != 0) {
+    std::cerr << "Error: Can't load alphabet " << options.alphabet << std::endl;
+    return 1;
+  }
+
+  if (options.vocab_size > 0) {
+    options.words = options.lm = "";
+    char words_path[] = "/tmp/decoder_benchmark_words_XXXXXX";
+    const int fd = mkstemp(words_path);
+    if (fd >= 0) {
+      close(fd);
+      options.words = words_path;
+      options.lm = write_random_lm(options.vocab_size, options.words);
+    }
+    if (options.lm.empty()) {
+      std::cerr << "Error: Can't write a temporary language model." << std::endl;
+      return 1;
+    }
+  }
+
+  vector<Scorer*> scorers = {nullptr};
+  Scorer scorer;
+  if (!options.lm.empty()) {
+    auto start = std::chrono::steady_clock::now();
+    const int err = scorer.init(options.lm_alpha, options.lm_beta, options.lm, options.trie, alphabet);
+    auto end = std::chrono::steady_clock::now();
+    if (err != 0) {
+      std::cerr << "Error: Can't load language model " << options.lm << std::endl;
+      return 1;
+    }
+    std::cout << "language model loaded in "
+              << std::chrono::duration<double, std::milli>(end - start).count()
+              << " ms" << std::endl;
+    scorers.push_back(&scorer);
+  }
+
+  const int num_classes = alphabet.GetSize() + 1;
+  vector<vector<int>> words;
+  if (!options.words.empty()) {
+    words = read_words(alphabet, options.words);
+    if (words.empty()) {
+      std::cerr << "Error: No word of " << options.words << " can be spelled "
+                << "with the alphabet." << std::endl;
+      return 1;
+    }
+  }
+  vector<int> reference;
+  const vector<double> probs = synthetic_probs(alphabet, words, options.frames, &reference);
+  const vector<vector<int>> reference_words = split_words(reference, alphabet.GetSpaceLabel());
+  if (options.vocab_size > 0) {
+    std::remove(options.lm.c_str());
+    std::remove(options.words.c_str());
+  }
+
+  if (scorer.dictionary != nullptr && !words.empty()) {
+    size_t num_lookups = 0;
+    const double ms = time_dictionary_lookups(*scorer.dictionary, words, alphabet.GetSize(),
+                                              options.repeats, &num_lookups);
+    std::cout << "dictionary of " << scorer.dictionary->size() << " bytes, "
+              << scorer.dictionary->num_dense_states() << " dense states: "
+              << num_lookups << " lookups in " << ms << " ms, "
+              << 1e6 * ms / num_lookups << " ns/lookup" << std::endl;
+  }
+
+  std::cout << "frames=" << options.frames << " streams=" << options.streams
+            << std::endl;
+  for (Scorer* ext_scorer : scorers) {
+    for (size_t beam_width : options.beam_widths) {
+      for (size_t num_threads : options.threads) {
+        for (double threshold : options.blank_skip_thresholds) {
+          auto decode = [&] {
+            return ctc_beam_search_decoder(probs.data(), options.frames, num_classes,
+                                           alphabet, beam_width, 1.0, 40, ext_scorer,
+                                           threshold, num_threads)[0].tokens;
+          };
+          double best_ms = 0;
+          vector<int> transcript;
+          for (int repeat = 0; repeat < options.repeats; ++repeat) {
+            auto start = std::chrono::steady_clock::now();
+            vector<std::thread> threads;
+            for (int s = 1; s < options.streams; ++s) {
+              threads.emplace_back(decode);
+            }
+            transcript = decode();
+            for (std::thread& thread : threads) {
+              thread.join();
+            }
+            auto end = std::chrono::steady_clock::now();
+            const double ms = std::chrono::duration<double, std::milli>(end - start).count();
+            if (repeat == 0 || ms < best_ms) {
+              best_ms = ms;
+            }
+          }
+          const double cer = 100.0 * edit_distance(transcript, reference) / reference.size();
+          const double wer = 100.0 * edit_distance(split_words(transcript, alphabet.GetSpaceLabel()),
+                                                   reference_words) / reference_words.size();
+          std::cout << (ext_scorer ? "lm" : "no lm") << " beam=" << beam_width
+                    << " threads=" << num_threads << " blank_skip=" << threshold
+                    << " " << best_ms << " ms, " << 1000 * best_ms / options.frames
+                    << " us/frame, wer " << wer << "%, cer " << cer << "%" << std::endl;
+        }
+      }
+    }
+  }
+  return 0;
+}
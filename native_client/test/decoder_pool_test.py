@@ -0,0 +1,139 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+from __future__ import absolute_import, division, print_function
+
+# Decode batches of synthetic utterances through a DecoderPool of the
+# ds_ctcdecoder package, checking that every utterance comes back once, with
+# the transcription it spells and the same results as decoding it on its own.
+# Exits with a non-zero status on any difference.
+
+import argparse
+import codecs
+import struct
+import sys
+
+import numpy as np
+
+from ds_ctcdecoder import DecoderPool, Scorer, ctc_beam_search_decoder
+
+
+BEAM_WIDTH = 64
+LM_ALPHA = 0.75
+LM_BETA = 1.85
+
+# Transcriptions of the utterances of each batch, the empty one having no
+# time step at all
+BATCHES = [
+    ['she had your dark suit', 'in greasy wash water', 'all year', 'a'],
+    ['', 'don\'t ask me to carry an oily rag like that'],
+]
+
+
+class Alphabet(object):
+    """Labels of the characters of an alphabet file, as util.text.Alphabet
+    loads them, without the training dependencies."""
+
+    def __init__(self, config_file):
+        self._labels = []
+        with codecs.open(config_file, 'r', 'utf-8') as fin:
+            for line in fin:
+                if line[0:2] == '\\#':
+                    line = '#\n'
+                elif line[0] == '#':
+                    continue
+                self._labels.append(line[:-1])
+        self._label_of = {char: label for label, char in enumerate(self._labels)}
+
+    def encode(self, string):
+        return [self._label_of[char] for char in string]
+
+    def decode(self, labels):
+        return ''.join(self._labels[label] for label in labels)
+
+    def serialize(self):
+        res = bytearray(struct.pack('<H', len(self._labels)))
+        for label, char in enumerate(self._labels):
+            char = char.encode('utf-8')
+            res += struct.pack('<HH{}s'.format(len(char)), label, len(char), char)
+        return bytes(res)
+
+    def size(self):
+        return len(self._labels)
+
+
+def spell(alphabet, text):
+    """Softmax outputs spelling text: each character is likely for two time
+    steps followed by a blank one."""
+    num_classes = alphabet.size() + 1
+    probs = np.full((3 * len(text), num_classes), 0.01)
+    for i, label in enumerate(alphabet.encode(text)):
+        probs[3 * i:3 * i + 2, label] = 1.0
+        probs[3 * i + 2, num_classes - 1] = 1.0
+    return probs / probs.sum(axis=1, keepdims=True)
+
+
+def batch_probs(alphabet, texts):
+    """Probabilities of the utterances spelling texts, padded to the longest,
+    and their lengths."""
+    utterances = [spell(alphabet, text) for text in texts]
+    max_length = max(len(probs) for probs in utterances)
+    batch = np.zeros((len(texts), max_length, alphabet.size() + 1))
+    for i, probs in enumerate(utterances):
+        batch[i, :len(probs)] = probs
+    return batch, np.array([len(probs) for probs in utterances], dtype=np.int32)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Testing decoding through a DecoderPool.')
+    parser.add_argument('--alphabet', required=True,
+                        help='Path to the alphabet file')
+    parser.add_argument('--lm', nargs='?',
+                        help='Path to the language model binary file')
+    parser.add_argument('--trie', nargs='?',
+                        help='Path to the language model trie file created with native_client/generate_trie')
+    args = parser.parse_args()
+
+    alphabet = Alphabet(args.alphabet)
+    scorers = [None]
+    if args.lm and args.trie:
+        scorers.append(Scorer(LM_ALPHA, LM_BETA, args.lm, args.trie, alphabet))
+
+    failures = 0
+    pool = DecoderPool(2)
+    for scorer in scorers:
+        name = 'with lm' if scorer else 'without lm'
+        submitted = {}
+        for texts in BATCHES:
+            probs, lengths = batch_probs(alphabet, texts)
+            batch = pool.submit(probs, lengths, alphabet, BEAM_WIDTH, scorer=scorer)
+            submitted[batch] = (texts, probs, lengths)
+
+        remaining = set((batch, index) for batch, (texts, _, _) in submitted.items()
+                        for index in range(len(texts)))
+        for batch, index, beam_results in pool.as_completed():
+            if (batch, index) not in remaining:
+                print('Error: {}: unexpected utterance {} of batch {}'.format(name, index, batch))
+                failures += 1
+                continue
+            remaining.remove((batch, index))
+
+            texts, probs, lengths = submitted[batch]
+            expected = ctc_beam_search_decoder(probs[index, :lengths[index]], alphabet,
+                                               BEAM_WIDTH, scorer=scorer)
+            if beam_results != expected:
+                print('Error: {}: utterance {} of batch {} decoded as {}, alone as {}'.format(
+                    name, index, batch, beam_results[:1], expected[:1]))
+                failures += 1
+            if scorer is None and beam_results[0][1] != texts[index]:
+                print('Error: {}: utterance {} of batch {} decoded as "{}", expected "{}"'.format(
+                    name, index, batch, beam_results[0][1], texts[index]))
+                failures += 1
+
+        for batch, index in sorted(remaining):
+            print('Error: {}: utterance {} of batch {} never decoded'.format(name, index, batch))
+            failures += 1
+
+    return 1 if failures > 0 else 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,146 @@
+// Check the timesteps the CTC beam search decoder gives to characters: each
+// character gets the time step where its probability was highest while it
+// ended the prefix, whatever order the prefixes of the beam are visited in,
+// and the same with several threads. Exits with a non-zero status if a
+// transcription or its timesteps differ from the expected ones.
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ctcdecode/ctc_beam_search_decoder.h"
+#include "alphabet.h"
+
+using std::vector;
+
+static int failures = 0;
+
+// Alphabet of a space and the letters a, b and c, labels 0 to 3, the blank
+// being label 4
+static Alphabet
+make_alphabet()
+{
+  vector<char> buffer;
+  auto write_u16 = [&](int value) {
+    buffer.push_back(value & 0xFF);
+    buffer.push_back(value >> 8);
+  };
+  const char characters[] = " abc";
+  write_u16(4);
+  for (int label = 0; label < 4; ++label) {
+    write_u16(label);
+    write_u16(1);
+    buffer.push_back(characters[label]);
+  }
+  Alphabet alphabet;
+  alphabet.deserialize(buffer.data(), buffer.size());
+  return alphabet;
+}
+
+static std::string
+to_string(const vector<int>& values)
+{
+  std::string str;
+  for (int value : values) {
+    str += (str.empty() ? "" : " ") + std::to_string(value);
+  }
+  return str;
+}
+
+static void
+expect_output(const Output& output, const vector<int>& tokens, const vector<int>& timesteps, const std::string& what)
+{
+  if (output.tokens != tokens || output.timesteps != timesteps) {
+    std::cerr << "Error: " << what << ": got tokens " << to_string(output.tokens)
+              << " at " << to_string(output.timesteps) << ", expected "
+              << to_string(tokens) << " at " << to_string(timesteps) << std::endl;
+    ++failures;
+  }
+}
+
+// Noisy softmax outputs with skewed classes, generated from the raw output
+// of the Mersenne twister, which is the same everywhere
+static vector<double>
+random_probs(unsigned int seed, int frames, int num_classes)
+{
+  std::mt19937 rng(seed);
+  vector<double> probs;
+  for (int t = 0; t < frames; ++t) {
+    vector<double> frame(num_classes);
+    double sum = 0;
+    for (double& p : frame) {
+      const double x = (rng() % 1000 + 1) / 1000.0;
+      p = x * x * x * x;
+      sum += p;
+    }
+    for (double p : frame) {
+      probs.push_back(p / sum);
+    }
+  }
+  return probs;
+}
+
+int
+main()
+{
+  const Alphabet alphabet = make_alphabet();
+  const int num_classes = 5;
+
+  // "a" is more likely at the second time step. The beam extends "a" to "aa"
+  // before the root reaches "a" again, which still moves "a" there.
+  const vector<double> later_peak = {
+    0, 0.6, 0, 0, 0.4,
+    0, 0.9, 0, 0, 0.1,
+    0, 0,   0, 0, 1,
+  };
+  expect_output(ctc_beam_search_decoder(later_peak.data(), 3, num_classes, alphabet, 8, 1.0, 40, nullptr)[0],
+                {1}, {1}, "later peak");
+
+  // "a" is less likely at the second time step, and keeps the first one
+  const vector<double> earlier_peak = {
+    0, 0.9, 0, 0, 0.1,
+    0, 0.6, 0, 0, 0.4,
+    0, 0,   0, 0, 1,
+  };
+  expect_output(ctc_beam_search_decoder(earlier_peak.data(), 3, num_classes, alphabet, 8, 1.0, 40, nullptr)[0],
+                {1}, {0}, "earlier peak");
+
+  // Longer random utterances
+  struct Case {
+    unsigned int seed;
+    size_t beam_width;
+    vector<int> tokens;
+    vector<int> timesteps;
+  };
+  const vector<Case> cases = {
+    {1, 4, {0, 3, 2, 0, 3, 1, 3, 1, 0, 1, 0, 1, 2, 3, 0, 2, 0, 3},
+     {0, 2, 3, 4, 5, 6, 7, 8, 11, 12, 15, 16, 18, 21, 25, 27, 28, 29}},
+    {1, 16, {0, 3, 2, 0, 1, 3, 1, 0, 1, 0, 1, 2, 3, 0, 2, 0, 3},
+     {0, 2, 3, 4, 6, 7, 8, 11, 12, 15, 17, 18, 21, 25, 27, 28, 29}},
+    {2, 4, {0, 3, 2, 0, 1, 0, 3, 1, 0, 2, 1, 0, 3, 1, 1, 2, 3, 1},
+     {0, 1, 4, 5, 7, 8, 9, 11, 13, 15, 16, 18, 19, 20, 23, 24, 27, 28}},
+    {2, 16, {0, 3, 2, 1, 0, 3, 1, 0, 2, 1, 0, 3, 1, 1, 2, 3, 1},
+     {0, 1, 4, 7, 8, 9, 11, 13, 15, 16, 18, 19, 20, 23, 24, 27, 28}},
+    {3, 4, {0, 3, 2, 1, 0, 1, 1, 0, 3, 2, 2, 1, 0, 3, 2},
+     {0, 1, 2, 3, 8, 11, 15, 16, 18, 20, 22, 24, 27, 28, 29}},
+    {3, 16, {0, 3, 2, 1, 2, 1, 0, 1, 1, 0, 3, 2, 2, 1, 0, 3, 2},
+     {0, 1, 2, 3, 4, 6, 8, 11, 15, 16, 18, 20, 22, 24, 27, 28, 29}},
+  };
+  for (const Case& c : cases) {
+    const vector<double> probs = random_probs(c.seed, 30, num_classes);
+    expect_output(ctc_beam_search_decoder(probs.data(), 30, num_classes, alphabet, c.beam_width, 1.0, 40, nullptr)[0],
+                  c.tokens, c.timesteps,
+                  "seed " + std::to_string(c.seed) + ", beam " + std::to_string(c.beam_width));
+  }
+
+  // Threads visit the prefixes of the beam in a different order
+  for (unsigned int seed = 0; seed < 4; ++seed) {
+    const vector<double> probs = random_probs(seed, 200, num_classes);
+    const Output serial = ctc_beam_search_decoder(probs.data(), 200, num_classes, alphabet, 128, 1.0, 40, nullptr)[0];
+    const Output parallel = ctc_beam_search_decoder(probs.data(), 200, num_classes, alphabet, 128, 1.0, 40, nullptr, 1.0, 4)[0];
+    expect_output(parallel, serial.tokens, serial.timesteps, "4 threads, seed " + std::to_string(seed));
+  }
+
+  return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,160 @@
+// Benchmark of the log probability updates in the inner loop of the beam
+// search, with the tabulated float log_sum_exp against the previous float
+// implementation, the generic log_sum_exp template. It replays the updates
+// DecoderState::next does for every class and prefix of a time step, on
+// prefixes and children laid out like trie nodes, without the trie lookups
+// and language model around them.
+//
+// Usage: log_sum_exp_benchmark [beam width, default 1024] [frames, default 200]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "ctcdecode/decoder_utils.h"
+
+using std::vector;
+
+struct Node {
+  float log_prob_b_prev;
+  float log_prob_nb_prev;
+  float log_prob_b_cur;
+  float log_prob_nb_cur;
+  float score;
+  int character;
+};
+
+struct Table {
+  static float add(float x, float y) { return log_sum_exp(x, y); }
+};
+
+struct Previous {
+  static float add(float x, float y) { return log_sum_exp<float>(x, y); }
+};
+
+// One time step of updates: blank, repeated character and extension to a
+// child for every class and prefix, then the advance of all nodes
+template <typename LogSumExp>
+static void
+time_step(const vector<std::pair<int, float>>& log_probs,
+          int blank,
+          vector<Node*>& prefixes,
+          vector<vector<Node*>>& children,
+          vector<Node*>& nodes)
+{
+  for (const auto& class_log_prob : log_probs) {
+    const int c = class_log_prob.first;
+    const float log_prob_c = class_log_prob.second;
+    for (size_t i = 0; i < prefixes.size(); ++i) {
+      Node* prefix = prefixes[i];
+      if (c == blank) {
+        prefix->log_prob_b_cur = LogSumExp::add(prefix->log_prob_b_cur, log_prob_c + prefix->score);
+        continue;
+      }
+      if (c == prefix->character) {
+        prefix->log_prob_nb_cur = LogSumExp::add(prefix->log_prob_nb_cur, log_prob_c + prefix->log_prob_nb_prev);
+      }
+      float log_p = -std::numeric_limits<float>::max();
+      if (c == prefix->character) {
+        log_p = log_prob_c + prefix->log_prob_b_prev;
+      } else {
+        log_p = log_prob_c + prefix->score;
+      }
+      Node* child = children[i][c];
+      child->log_prob_nb_cur = LogSumExp::add(child->log_prob_nb_cur, log_p);
+    }
+  }
+
+  for (Node* node : nodes) {
+    node->log_prob_b_prev = node->log_prob_b_cur;
+    node->log_prob_nb_prev = node->log_prob_nb_cur;
+    node->log_prob_b_cur = -std::numeric_limits<float>::max();
+    node->log_prob_nb_cur = -std::numeric_limits<float>::max();
+    node->score = LogSumExp::add(node->log_prob_b_prev, node->log_prob_nb_prev);
+  }
+}
+
+template <typename LogSumExp>
+static double
+run(int beam_width, int frames, double* checksum)
+{
+  const int num_classes = 29;
+  const int blank = num_classes - 1;
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> uniform(0, 1);
+
+  // Prefixes and their children, allocated in shuffled order so that
+  // visiting them jumps around memory like visiting trie nodes does
+  vector<Node> storage((size_t)beam_width * (num_classes + 1));
+  vector<Node*> nodes;
+  for (Node& node : storage) {
+    node.log_prob_b_prev = -30 * uniform(rng);
+    node.log_prob_nb_prev = -30 * uniform(rng);
+    node.log_prob_b_cur = -std::numeric_limits<float>::max();
+    node.log_prob_nb_cur = -std::numeric_limits<float>::max();
+    node.score = LogSumExp::add(node.log_prob_b_prev, node.log_prob_nb_prev);
+    node.character = rng() % blank;
+    nodes.push_back(&node);
+  }
+  std::shuffle(nodes.begin(), nodes.end(), rng);
+  vector<Node*> prefixes(nodes.begin(), nodes.begin() + beam_width);
+  vector<vector<Node*>> children(beam_width);
+  for (int i = 0; i < beam_width; ++i) {
+    children[i].assign(nodes.begin() + beam_width + i * num_classes,
+                       nodes.begin() + beam_width + (i + 1) * num_classes);
+  }
+
+  vector<vector<std::pair<int, float>>> log_probs(frames);
+  for (auto& frame : log_probs) {
+    for (int c = 0; c < num_classes; ++c) {
+      frame.emplace_back(c, std::log(0.001f + uniform(rng)) - 3);
+    }
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (int t = 0; t < frames; ++t) {
+    time_step<LogSumExp>(log_probs[t], blank, prefixes, children, nodes);
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  // Sum of the scores of the possible nodes, so that both versions can be
+  // compared
+  *checksum = 0;
+  for (const Node& node : storage) {
+    if (node.score > -std::numeric_limits<float>::max()) {
+      *checksum += node.score;
+    }
+  }
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int
+main(int argc, char** argv)
+{
+  const int beam_width = argc > 1 ? std::atoi(argv[1]) : 1024;
+  const int frames = argc > 2 ? std::atoi(argv[2]) : 200;
+  if (beam_width <= 0 || frames <= 0) {
+    std::cerr << "Usage: " << argv[0] << " [beam width] [frames]" << std::endl;
+    return 1;
+  }
+
+  double previous_checksum, table_checksum;
+  // Warm up
+  run<Previous>(beam_width, 1, &previous_checksum);
+  const double previous_ms = run<Previous>(beam_width, frames, &previous_checksum);
+  const double table_ms = run<Table>(beam_width, frames, &table_checksum);
+
+  std::cout << "beam=" << beam_width << " frames=" << frames << std::endl;
+  std::cout << "previous log_sum_exp: " << previous_ms << " ms, "
+            << 1000 * previous_ms / frames << " us/frame" << std::endl;
+  std::cout << "tabulated log_sum_exp: " << table_ms << " ms, "
+            << 1000 * table_ms / frames << " us/frame" << std::endl;
+  std::cout << "speedup " << previous_ms / table_ms << "x, checksums "
+            << previous_checksum << " and " << table_checksum << std::endl;
+  return 0;
+}
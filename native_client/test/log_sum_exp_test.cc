@@ -0,0 +1,86 @@
+// Check the tabulated float log_sum_exp of the decoder against the previous
+// float implementation, the generic log_sum_exp template, and against the
+// exact value computed in double. Exits with a non-zero status if the table
+// makes it less accurate.
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+#include "ctcdecode/decoder_utils.h"
+
+static int failures = 0;
+
+static void
+expect(bool condition, const char* what, double value, double bound)
+{
+  std::cout << what << ": " << value << " (bound " << bound << ")" << std::endl;
+  if (!condition) {
+    std::cerr << "Error: " << what << " is out of bounds." << std::endl;
+    ++failures;
+  }
+}
+
+static double
+exact_log_sum_exp(double x, double y)
+{
+  return std::max(x, y) + std::log1p(std::exp(-std::fabs(x - y)));
+}
+
+int
+main()
+{
+  // log(1 + exp(-d)) alone, against the same computed with float exp and log
+  double table_error = 0;
+  double float_error = 0;
+  for (double d = 0; d < 20; d += 1e-5) {
+    const double exact = std::log1p(std::exp(-d));
+    const float x = static_cast<float>(d);
+    table_error = std::max(table_error, std::fabs(log1p_exp_neg(x) - exact));
+    float_error = std::max(float_error, std::fabs(std::log(1.f + std::exp(-x)) - exact));
+  }
+  expect(table_error <= 1.5e-7, "max error of the log1p(exp(-d)) table", table_error, 1.5e-7);
+  std::cout << "max error of log1p(exp(-d)) with float exp and log: " << float_error << std::endl;
+
+  // Whole sums over the range of log probabilities the decoder adds up. The
+  // error of both versions comes from rounding the result to float.
+  double new_error = 0;
+  double old_error = 0;
+  double max_difference = 0;
+  for (double a = -300; a < 0; a += 0.0137) {
+    for (double b = -20; b < 20; b += 0.0391) {
+      const float x = static_cast<float>(a);
+      const float y = static_cast<float>(a + b);
+      const double exact = exact_log_sum_exp(x, y);
+      const float new_value = log_sum_exp(x, y);
+      const float old_value = log_sum_exp<float>(x, y);
+      new_error = std::max(new_error, std::fabs(new_value - exact) / std::max(1.0, std::fabs(exact)));
+      old_error = std::max(old_error, std::fabs(old_value - exact) / std::max(1.0, std::fabs(exact)));
+      max_difference = std::max(max_difference, std::fabs(new_value - old_value) / std::max(1.0, std::fabs(exact)));
+    }
+  }
+  const double epsilon = std::numeric_limits<float>::epsilon();
+  expect(new_error <= old_error + epsilon / 4, "max relative error of log_sum_exp",
+         new_error, old_error + epsilon / 4);
+  std::cout << "max relative error of the previous log_sum_exp: " << old_error << std::endl;
+  expect(max_difference <= 2 * epsilon, "max relative difference with the previous log_sum_exp",
+         max_difference, 2 * epsilon);
+
+  // Operands the decoder uses for impossible prefixes, and equal operands
+  const float num_min = -std::numeric_limits<float>::max();
+  const float log_two = std::log(2.f);
+  const bool special_cases =
+      log_sum_exp(num_min, -3.f) == -3.f &&
+      log_sum_exp(-3.f, num_min) == -3.f &&
+      log_sum_exp(num_min, num_min) == num_min &&
+      log_sum_exp(-std::numeric_limits<float>::infinity(), -3.f) == -3.f &&
+      std::fabs(log_sum_exp(-3.f, -3.f) - (log_two - 3.f)) <= 4 * epsilon &&
+      log_sum_exp(0.f, -100.f) == 0.f;
+  if (!special_cases) {
+    std::cerr << "Error: log_sum_exp of special values is wrong." << std::endl;
+    ++failures;
+  }
+
+  return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,143 @@
+// Check the native MFCC feature computation against the TensorFlow kernels of
+// the AudioSpectrogram and Mfcc ops, which the exported feature graph runs.
+// Exits with a non-zero status if any feature differs.
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "tensorflow/core/kernels/mfcc.h"
+#include "tensorflow/core/kernels/spectrogram.h"
+
+#include "mfcc.h"
+
+using std::vector;
+
+struct Config {
+  unsigned int sample_rate;
+  unsigned int window_length;
+  unsigned int coefficient_count;
+};
+
+// Features of one window of samples as computed by the graph: a magnitude
+// squared float spectrogram, then MFCCs in double precision output as float
+static bool
+graph_mfcc(const Config& config,
+           const vector<float>& samples,
+           vector<float>* output)
+{
+  tensorflow::Spectrogram spectrogram;
+  if (!spectrogram.Initialize(config.window_length, config.window_length)) {
+    return false;
+  }
+  vector<vector<float>> spectrogram_output;
+  if (!spectrogram.ComputeSquaredMagnitudeSpectrogram(samples, &spectrogram_output) ||
+      spectrogram_output.size() != 1) {
+    return false;
+  }
+
+  tensorflow::Mfcc mfcc;
+  mfcc.set_dct_coefficient_count(config.coefficient_count);
+  if (!mfcc.Initialize(spectrogram.output_frequency_channels(), config.sample_rate)) {
+    return false;
+  }
+  vector<double> frame(spectrogram_output[0].begin(), spectrogram_output[0].end());
+  vector<double> mfcc_output;
+  mfcc.Compute(frame, &mfcc_output);
+
+  output->assign(mfcc_output.begin(), mfcc_output.end());
+  return true;
+}
+
+// Deterministic test signals of a full window, the last one being silence
+static vector<vector<float>>
+test_signals(const Config& config)
+{
+  const double pi = std::atan(1) * 4;
+  vector<vector<float>> signals(4, vector<float>(config.window_length));
+  for (unsigned int i = 0; i < config.window_length; ++i) {
+    const double t = (double)i / config.sample_rate;
+    const float noise = (((i * 7919) % 101) - 50) / 50.0f;
+    // Two tones plus some broadband noise
+    signals[0][i] = 0.5 * std::sin(2 * pi * 440 * t)
+                  + 0.25 * std::sin(2 * pi * 1800 * t)
+                  + 0.01 * noise;
+    // Full scale noise
+    signals[1][i] = noise;
+    // A chirp going up to the upper limit of the filterbank
+    signals[2][i] = 0.8 * std::sin(2 * pi * (100 + 4000 * t / 0.032) * t);
+  }
+  return signals;
+}
+
+static int
+check(const Config& config)
+{
+  MfccExtractor extractor;
+  if (extractor.init(config.sample_rate, config.window_length, config.coefficient_count) != 0) {
+    std::cerr << "Error: native features can't be computed at "
+              << config.sample_rate << " Hz, window of " << config.window_length
+              << " samples." << std::endl;
+    return 1;
+  }
+
+  int failures = 0;
+  const vector<vector<float>> signals = test_signals(config);
+  for (size_t s = 0; s < signals.size(); ++s) {
+    // Partial windows are computed as if zero-filled
+    for (unsigned int n_samples : {config.window_length, config.window_length / 2}) {
+      vector<float> samples(signals[s]);
+      std::fill(samples.begin() + n_samples, samples.end(), 0.f);
+
+      vector<float> expected;
+      if (!graph_mfcc(config, samples, &expected) ||
+          expected.size() != config.coefficient_count) {
+        std::cerr << "Error: could not compute reference features." << std::endl;
+        return 1;
+      }
+
+      vector<float> actual(config.coefficient_count);
+      extractor.compute(signals[s].data(), n_samples, actual.data());
+
+      for (unsigned int i = 0; i < config.coefficient_count; ++i) {
+        const float tolerance = 1e-3f * std::max(1.0f, std::fabs(expected[i]));
+        if (!(std::fabs(expected[i] - actual[i]) <= tolerance)) {
+          std::cerr << "Mismatch at " << config.sample_rate << " Hz, window of "
+                    << config.window_length << " samples, signal " << s
+                    << " of " << n_samples << " samples, coefficient " << i
+                    << ": expected " << expected[i] << ", got " << actual[i]
+                    << std::endl;
+          ++failures;
+        }
+      }
+    }
+  }
+  return failures;
+}
+
+int
+main(int argc, char** argv)
+{
+  // The default feature configuration of exported models, and window lengths
+  // that aren't a power of two or take other sample rates
+  const Config configs[] = {
+    {16000, 512, 26},
+    {16000, 400, 26},
+    {16000, 320, 13},
+    {22050, 706, 26},
+    {44100, 1411, 40},
+  };
+
+  int failures = 0;
+  for (const Config& config : configs) {
+    failures += check(config);
+  }
+
+  if (failures > 0) {
+    std::cerr << failures << " features don't match." << std::endl;
+    return 1;
+  }
+  std::cout << "Native MFCC features match the TensorFlow kernels." << std::endl;
+  return 0;
+}
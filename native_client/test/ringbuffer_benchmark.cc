@@ -0,0 +1,183 @@
+// Microbenchmark of the streaming buffers: sliding the audio and MFCC windows
+// of StreamingState with RingBuffer, against the previous vectors shifted
+// left with std::rotate after each window. Both consume the same windows,
+// which is checked, so only the buffering differs.
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "ringbuffer.h"
+
+using std::vector;
+
+// Default feature configuration of exported models: 32 ms windows every
+// 20 ms at 16 kHz, 26 features with 9 frames of context on each side
+static const unsigned int kWinLen = 512;
+static const unsigned int kWinStep = 320;
+static const unsigned int kFeatures = 26;
+static const unsigned int kContext = 9;
+static const unsigned int kFeatsPerTimestep = kFeatures * (2 * kContext + 1);
+// Number of windows computed at once from the ring buffer
+static const unsigned int kBulkWindows = 256;
+
+// Stand in for the feature computation, cheap enough not to hide the
+// buffering cost but depending on the whole window
+static double
+consume(const float* window, unsigned int length)
+{
+  return window[0] + 2 * window[length / 2] + 3 * window[length - 1];
+}
+
+static double
+audio_rotate(const vector<short>& audio, unsigned int chunk_size)
+{
+  vector<float> buffer;
+  buffer.reserve(kWinLen);
+  double checksum = 0;
+  for (size_t offset = 0; offset < audio.size(); offset += chunk_size) {
+    const short* samples = &audio[offset];
+    unsigned int n_samples = std::min<size_t>(chunk_size, audio.size() - offset);
+    while (n_samples > 0) {
+      while (n_samples > 0 && buffer.size() < kWinLen) {
+        buffer.push_back((float)(*samples) * (1.0f / (1 << 15)));
+        ++samples;
+        --n_samples;
+      }
+      if (buffer.size() == kWinLen) {
+        checksum += consume(buffer.data(), kWinLen);
+        std::rotate(buffer.begin(), buffer.begin() + kWinStep, buffer.end());
+        buffer.resize(buffer.size() - kWinStep);
+      }
+    }
+  }
+  return checksum;
+}
+
+static double
+audio_ring(const vector<short>& audio, unsigned int chunk_size)
+{
+  RingBuffer<float> buffer;
+  buffer.init(kWinLen + (kBulkWindows - 1) * kWinStep);
+  const unsigned int block_size = 512;
+  float converted[block_size];
+  double checksum = 0;
+  for (size_t offset = 0; offset < audio.size(); offset += chunk_size) {
+    const short* samples = &audio[offset];
+    unsigned int n_samples = std::min<size_t>(chunk_size, audio.size() - offset);
+    while (n_samples > 0) {
+      const unsigned int count = std::min<unsigned int>(n_samples, buffer.free_space());
+      for (unsigned int done = 0; done < count; done += block_size) {
+        const unsigned int block = std::min(block_size, count - done);
+        for (unsigned int i = 0; i < block; ++i) {
+          converted[i] = (float)samples[done + i] * (1.0f / (1 << 15));
+        }
+        buffer.push(converted, block);
+      }
+      samples += count;
+      n_samples -= count;
+      if (buffer.size() >= kWinLen) {
+        const unsigned int n_windows = 1 + (buffer.size() - kWinLen) / kWinStep;
+        for (unsigned int i = 0; i < n_windows; ++i) {
+          checksum += consume(buffer.data() + i * kWinStep, kWinLen);
+        }
+        buffer.pop(n_windows * kWinStep);
+      }
+    }
+  }
+  return checksum;
+}
+
+static double
+mfcc_rotate(const vector<float>& features)
+{
+  vector<float> buffer(kFeatures * kContext, 0.f);
+  buffer.reserve(kFeatsPerTimestep);
+  double checksum = 0;
+  for (size_t offset = 0; offset < features.size(); offset += kFeatures) {
+    buffer.insert(buffer.end(), &features[offset], &features[offset] + kFeatures);
+    if (buffer.size() == kFeatsPerTimestep) {
+      checksum += consume(buffer.data(), kFeatsPerTimestep);
+      std::rotate(buffer.begin(), buffer.begin() + kFeatures, buffer.end());
+      buffer.resize(buffer.size() - kFeatures);
+    }
+  }
+  return checksum;
+}
+
+static double
+mfcc_ring(const vector<float>& features)
+{
+  RingBuffer<float> buffer;
+  buffer.init(kFeatsPerTimestep);
+  buffer.push_n(kFeatures * kContext, 0.f);
+  double checksum = 0;
+  for (size_t offset = 0; offset < features.size(); offset += kFeatures) {
+    buffer.push(&features[offset], kFeatures);
+    if (buffer.full()) {
+      checksum += consume(buffer.data(), kFeatsPerTimestep);
+      buffer.pop(kFeatures);
+    }
+  }
+  return checksum;
+}
+
+template <typename Function>
+static double
+time_ms(int repeats, double* result, Function function)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < repeats; ++i) {
+    *result = function();
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count() / repeats;
+}
+
+static void
+report(const char* name, double rotate_ms, double ring_ms)
+{
+  std::cout << name << ": rotate " << rotate_ms << " ms, ring " << ring_ms
+            << " ms, speedup " << rotate_ms / ring_ms << "x" << std::endl;
+}
+
+int
+main(int argc, char** argv)
+{
+  const int repeats = 20;
+
+  // One minute of deterministic audio and its number of feature frames
+  vector<short> audio(60 * 16000);
+  unsigned int state = 1;
+  for (short& sample : audio) {
+    state = state * 1103515245 + 12345;
+    sample = (short)(state >> 16);
+  }
+  vector<float> features(((audio.size() - kWinLen) / kWinStep + 1) * kFeatures);
+  for (size_t i = 0; i < features.size(); ++i) {
+    features[i] = (float)((i * 7919) % 101) / 101;
+  }
+
+  bool mismatch = false;
+  for (unsigned int chunk_size : {320u, 1024u, 16000u, 160000u}) {
+    double rotate_result, ring_result;
+    const double rotate_ms = time_ms(repeats, &rotate_result, [&] { return audio_rotate(audio, chunk_size); });
+    const double ring_ms = time_ms(repeats, &ring_result, [&] { return audio_ring(audio, chunk_size); });
+    std::cout << "audio, chunks of " << chunk_size << " samples";
+    report("", rotate_ms, ring_ms);
+    mismatch |= rotate_result != ring_result;
+  }
+
+  double rotate_result, ring_result;
+  const double rotate_ms = time_ms(repeats, &rotate_result, [&] { return mfcc_rotate(features); });
+  const double ring_ms = time_ms(repeats, &ring_result, [&] { return mfcc_ring(features); });
+  report("mfcc context windows", rotate_ms, ring_ms);
+  mismatch |= rotate_result != ring_result;
+
+  if (mismatch) {
+    std::cerr << "Error: both buffers did not see the same windows." << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,124 @@
+// Check lookups in the dictionary transition table, built from an FST and
+// used in place from its written form, including the empty table of an empty
+// vocabulary. Exits with a non-zero status if a lookup is wrong.
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ctcdecode/transition_table.h"
+
+static int failures = 0;
+
+static void
+expect(bool condition, const std::string& what)
+{
+  if (!condition) {
+    std::cerr << "Error: " << what << std::endl;
+    ++failures;
+  }
+}
+
+// Look up every label up to max_label + 1 from every state of the FST,
+// expecting the arcs of the FST and nothing else
+static void
+check_lookups(const fst::StdVectorFst& fst, const TransitionTable& table, const std::string& name)
+{
+  expect(table.start() == fst.Start(), name + ": wrong start state");
+  for (int s = 0; s < fst.NumStates(); ++s) {
+    expect(table.is_final(s) == (fst.Final(s) != fst::TropicalWeight::Zero()),
+           name + ": wrong final state " + std::to_string(s));
+    for (int label = -1; label <= table.max_label() + 1; ++label) {
+      bool expected = false;
+      fst::StdArc expected_arc(0, 0, 0, 0);
+      for (fst::ArcIterator<fst::StdVectorFst> it(fst, s); !it.Done(); it.Next()) {
+        if (it.Value().ilabel == label) {
+          expected = true;
+          expected_arc = it.Value();
+        }
+      }
+      TransitionTable::StateId next_state = 0;
+      int olabel = 0;
+      const bool found = table.find(s, label, &next_state, &olabel);
+      expect(found == expected &&
+             (!found || (next_state == expected_arc.nextstate && olabel == expected_arc.olabel)),
+             name + ": wrong lookup of label " + std::to_string(label) +
+             " from state " + std::to_string(s));
+    }
+  }
+}
+
+// The table written and used in place from the written bytes
+static std::vector<std::uint64_t>
+written(const TransitionTable& table)
+{
+  std::ostringstream out;
+  table.write(out);
+  const std::string bytes = out.str();
+  std::vector<std::uint64_t> data((bytes.size() + 7) / 8);
+  bytes.copy(reinterpret_cast<char*>(data.data()), bytes.size());
+  return data;
+}
+
+int
+main()
+{
+  // Empty vocabulary: no state at all, the start state is kNoStateId
+  {
+    fst::StdVectorFst fst;
+    TransitionTable table(fst);
+    TransitionTable::StateId next_state = 0;
+    int olabel = 0;
+    expect(table.valid(), "empty: invalid table");
+    expect(table.start() == fst::kNoStateId, "empty: start state exists");
+    expect(!table.find(table.start(), 0, &next_state, &olabel), "empty: transition from no state");
+    expect(!table.is_final(table.start()), "empty: no state is final");
+
+    const std::vector<std::uint64_t> data = written(table);
+    TransitionTable loaded(reinterpret_cast<const char*>(data.data()), data.size() * 8);
+    expect(loaded.valid(), "empty written: invalid table");
+    expect(!loaded.find(loaded.start(), 0, &next_state, &olabel), "empty written: transition from no state");
+    expect(!loaded.is_final(loaded.start()), "empty written: no state is final");
+  }
+
+  // Root with an arc for every label gets a dense row, the others are
+  // searched. Labels are those of alphabet characters plus one.
+  {
+    fst::StdVectorFst fst;
+    const int max_label = 28;
+    const int root = fst.AddState();
+    fst.SetStart(root);
+    for (int label = 1; label <= max_label; ++label) {
+      const int s = fst.AddState();
+      fst.AddArc(root, fst::StdArc(label, 100 + label, 0, s));
+      if (label % 3 == 0) {
+        fst.SetFinal(s, 0);
+      }
+      for (int next = 1; next <= max_label; next += label) {
+        const int t = fst.AddState();
+        fst.SetFinal(t, 0);
+        fst.AddArc(s, fst::StdArc(next, next, 0, t));
+      }
+    }
+
+    TransitionTable table(fst);
+    expect(table.valid(), "built: invalid table");
+    expect(table.num_dense_states() >= 1, "built: no dense row");
+    check_lookups(fst, table, "built");
+
+    const std::vector<std::uint64_t> data = written(table);
+    TransitionTable loaded(reinterpret_cast<const char*>(data.data()), data.size() * 8);
+    expect(loaded.valid(), "written: invalid table");
+    check_lookups(fst, loaded, "written");
+
+    // Lookups keep working once the data the table was used from is gone
+    std::vector<std::uint64_t> released = data;
+    TransitionTable copied(reinterpret_cast<const char*>(released.data()), released.size() * 8);
+    copied.copy_data();
+    released.assign(released.size(), ~0ull);
+    check_lookups(fst, copied, "copied");
+  }
+
+  return failures > 0 ? 1 : 0;
+}
@@ -1,19 +1,24 @@
 #include "tflitemodelstate.h"
 
+#include <algorithm>
+#include <thread>
+
 #include "tensorflow/lite/string_util.h"
+#include "threadaffinity.h"
 #include "workspace_status.h"
 
 using namespace tflite;
 using std::vector;
 
 int
-TFLiteModelState::get_tensor_by_name(const vector<int>& list,
+TFLiteModelState::get_tensor_by_name(Interpreter* interpreter,
+                                     const vector<int>& list,
                                      const char* name)
 {
   int rv = -1;
 
   for (int i = 0; i < list.size(); ++i) {
-    const string& node_name = interpreter_->tensor(list[i])->name;
+    const string& node_name = interpreter->tensor(list[i])->name;
     if (node_name.compare(string(name)) == 0) {
       rv = i;
     }
@@ -24,17 +29,17 @@ TFLiteModelState::get_tensor_by_name(const vector<int>& list,
 }
 
 int
-TFLiteModelState::get_input_tensor_by_name(const char* name)
+TFLiteModelState::get_input_tensor_by_name(Interpreter* interpreter, const char* name)
 {
-  int idx = get_tensor_by_name(interpreter_->inputs(), name);
-  return interpreter_->inputs()[idx];
+  int idx = get_tensor_by_name(interpreter, interpreter->inputs(), name);
+  return interpreter->inputs()[idx];
 }
 
 int
-TFLiteModelState::get_output_tensor_by_name(const char* name)
+TFLiteModelState::get_output_tensor_by_name(Interpreter* interpreter, const char* name)
 {
-  int idx = get_tensor_by_name(interpreter_->outputs(), name);
-  return interpreter_->outputs()[idx];
+  int idx = get_tensor_by_name(interpreter, interpreter->outputs(), name);
+  return interpreter->outputs()[idx];
 }
 
 void
@@ -51,7 +56,7 @@ push_back_if_not_present(std::deque<int>& list, int value)
 // list. Because we start from the final tensor and work backwards to the inputs,
 // the parents list is constructed in reverse, adding elements to its front.
 vector<int>
-TFLiteModelState::find_parent_node_ids(int tensor_id)
+TFLiteModelState::find_parent_node_ids(Interpreter* interpreter, int tensor_id)
 {
   std::deque<int> parents;
   std::deque<int> frontier;
@@ -60,8 +65,8 @@ TFLiteModelState::find_parent_node_ids(int tensor_id)
     int next_tensor_id = frontier.front();
     frontier.pop_front();
     // Find all nodes that have next_tensor_id as an output
-    for (int node_id = 0; node_id < interpreter_->nodes_size(); ++node_id) {
-      TfLiteNode node = interpreter_->node_and_registration(node_id)->first;
+    for (int node_id = 0; node_id < interpreter->nodes_size(); ++node_id) {
+      TfLiteNode node = interpreter->node_and_registration(node_id)->first;
       // Search node outputs for the tensor we're looking for
       for (int i = 0; i < node.outputs->size; ++i) {
         if (node.outputs->data[i] == next_tensor_id) {
@@ -81,8 +86,9 @@ TFLiteModelState::find_parent_node_ids(int tensor_id)
 
 TFLiteModelState::TFLiteModelState()
   : ModelState()
-  , interpreter_(nullptr)
   , fbmodel_(nullptr)
+  , n_interpreters_(0)
+  , max_interpreters_(std::max(1u, std::thread::hardware_concurrency()))
 {
 }
 
@@ -90,6 +96,113 @@ TFLiteModelState::~TFLiteModelState()
 {
 }
 
+// Returns an interpreter to the pool when going out of scope
+class TFLiteModelState::ScopedInterpreter {
+public:
+  explicit ScopedInterpreter(TFLiteModelState* model)
+    : model_(model)
+    , interpreter_(model->acquire_interpreter())
+  {
+  }
+
+  ~ScopedInterpreter()
+  {
+    if (interpreter_) {
+      model_->release_interpreter(std::move(interpreter_));
+    }
+  }
+
+  Interpreter* get() const { return interpreter_.get(); }
+
+private:
+  TFLiteModelState* model_;
+  std::unique_ptr<Interpreter> interpreter_;
+};
+
+std::unique_ptr<Interpreter>
+TFLiteModelState::new_interpreter()
+{
+  std::unique_ptr<Interpreter> interpreter;
+  tflite::ops::builtin::BuiltinOpResolver resolver;
+  tflite::InterpreterBuilder(*fbmodel_, resolver)(&interpreter);
+  if (!interpreter) {
+    return nullptr;
+  }
+
+  if (interpreter->AllocateTensors() != kTfLiteOk) {
+    return nullptr;
+  }
+  interpreter->SetNumThreads(intra_op_threads_ > 0 ? intra_op_threads_ : 4);
+
+  return interpreter;
+}
+
+std::unique_ptr<Interpreter>
+TFLiteModelState::acquire_interpreter()
+{
+  std::unique_lock<std::mutex> lock(interpreters_mutex_);
+  interpreters_cv_.wait(lock, [this] {
+    return !idle_interpreters_.empty() || n_interpreters_ < max_interpreters_;
+  });
+
+  if (!idle_interpreters_.empty()) {
+    std::unique_ptr<Interpreter> interpreter = std::move(idle_interpreters_.back());
+    idle_interpreters_.pop_back();
+    return interpreter;
+  }
+
+  // Build a new interpreter without holding the lock, the slot is reserved
+  ++n_interpreters_;
+  lock.unlock();
+  std::unique_ptr<Interpreter> interpreter;
+  {
+    ScopedCpuAffinity affinity(cpu_affinity_mask_);
+    interpreter = new_interpreter();
+  }
+  if (!interpreter) {
+    std::cerr << "Error at InterpreterBuilder for concurrent inference" << std::endl;
+    lock.lock();
+    --n_interpreters_;
+    interpreters_cv_.notify_one();
+  }
+  return interpreter;
+}
+
+void
+TFLiteModelState::release_interpreter(std::unique_ptr<Interpreter> interpreter)
+{
+  {
+    std::lock_guard<std::mutex> lock(interpreters_mutex_);
+    if (n_interpreters_ > max_interpreters_) {
+      // The pool was shrunk while this interpreter was in use
+      --n_interpreters_;
+    } else {
+      idle_interpreters_.push_back(std::move(interpreter));
+    }
+  }
+  interpreters_cv_.notify_one();
+}
+
+int
+TFLiteModelState::set_max_concurrency(unsigned int max_concurrency)
+{
+  if (max_concurrency == 0) {
+    std::cerr << "Error: Maximum concurrency must be at least one." << std::endl;
+    return DS_ERR_INVALID_ARGUMENT;
+  }
+
+  std::unique_lock<std::mutex> lock(interpreters_mutex_);
+  max_interpreters_ = max_concurrency;
+  // Drop idle interpreters in excess, busy ones are dropped when released
+  while (n_interpreters_ > max_interpreters_ && !idle_interpreters_.empty()) {
+    idle_interpreters_.pop_back();
+    --n_interpreters_;
+  }
+  lock.unlock();
+  interpreters_cv_.notify_all();
+  return DS_ERR_OK;
+}
+
 int
 TFLiteModelState::init(const char* model_path,
                        unsigned int beam_width)
@@ -105,50 +218,48 @@ TFLiteModelState::init(const char* model_path,
     return DS_ERR_FAIL_INIT_MMAP;
   }
 
-  tflite::ops::builtin::BuiltinOpResolver resolver;
-  tflite::InterpreterBuilder(*fbmodel_, resolver)(&interpreter_);
-  if (!interpreter_) {
+  // All the interpreters are built from the same model, so tensor indices and
+  // execution plans computed with the first one are valid for all of them
+  std::unique_ptr<Interpreter> interpreter = new_interpreter();
+  if (!interpreter) {
     std::cerr << "Error at InterpreterBuilder for model file " << model_path << std::endl;
     return DS_ERR_FAIL_INTERPRETER;
   }
 
-  interpreter_->AllocateTensors();
-  interpreter_->SetNumThreads(4);
-
   // Query all the index once
-  input_node_idx_       = get_input_tensor_by_name("input_node");
-  previous_state_c_idx_ = get_input_tensor_by_name("previous_state_c");
-  previous_state_h_idx_ = get_input_tensor_by_name("previous_state_h");
-  input_samples_idx_    = get_input_tensor_by_name("input_samples");
-  logits_idx_           = get_output_tensor_by_name("logits");
-  new_state_c_idx_      = get_output_tensor_by_name("new_state_c");
-  new_state_h_idx_      = get_output_tensor_by_name("new_state_h");
-  mfccs_idx_            = get_output_tensor_by_name("mfccs");
-
-  int metadata_version_idx  = get_output_tensor_by_name("metadata_version");
-  int metadata_sample_rate_idx      = get_output_tensor_by_name("metadata_sample_rate");
-  int metadata_feature_win_len_idx  = get_output_tensor_by_name("metadata_feature_win_len");
-  int metadata_feature_win_step_idx = get_output_tensor_by_name("metadata_feature_win_step");
-  int metadata_alphabet_idx = get_output_tensor_by_name("metadata_alphabet");
+  input_node_idx_       = get_input_tensor_by_name(interpreter.get(), "input_node");
+  previous_state_c_idx_ = get_input_tensor_by_name(interpreter.get(), "previous_state_c");
+  previous_state_h_idx_ = get_input_tensor_by_name(interpreter.get(), "previous_state_h");
+  input_samples_idx_    = get_input_tensor_by_name(interpreter.get(), "input_samples");
+  logits_idx_           = get_output_tensor_by_name(interpreter.get(), "logits");
+  new_state_c_idx_      = get_output_tensor_by_name(interpreter.get(), "new_state_c");
+  new_state_h_idx_      = get_output_tensor_by_name(interpreter.get(), "new_state_h");
+  mfccs_idx_            = get_output_tensor_by_name(interpreter.get(), "mfccs");
+
+  int metadata_version_idx  = get_output_tensor_by_name(interpreter.get(), "metadata_version");
+  int metadata_sample_rate_idx      = get_output_tensor_by_name(interpreter.get(), "metadata_sample_rate");
+  int metadata_feature_win_len_idx  = get_output_tensor_by_name(interpreter.get(), "metadata_feature_win_len");
+  int metadata_feature_win_step_idx = get_output_tensor_by_name(interpreter.get(), "metadata_feature_win_step");
+  int metadata_alphabet_idx = get_output_tensor_by_name(interpreter.get(), "metadata_alphabet");
 
   std::vector<int> metadata_exec_plan;
-  metadata_exec_plan.push_back(find_parent_node_ids(metadata_version_idx)[0]);
-  metadata_exec_plan.push_back(find_parent_node_ids(metadata_sample_rate_idx)[0]);
-  metadata_exec_plan.push_back(find_parent_node_ids(metadata_feature_win_len_idx)[0]);
-  metadata_exec_plan.push_back(find_parent_node_ids(metadata_feature_win_step_idx)[0]);
-  metadata_exec_plan.push_back(find_parent_node_ids(metadata_alphabet_idx)[0]);
+  metadata_exec_plan.push_back(find_parent_node_ids(interpreter.get(), metadata_version_idx)[0]);
+  metadata_exec_plan.push_back(find_parent_node_ids(interpreter.get(), metadata_sample_rate_idx)[0]);
+  metadata_exec_plan.push_back(find_parent_node_ids(interpreter.get(), metadata_feature_win_len_idx)[0]);
+  metadata_exec_plan.push_back(find_parent_node_ids(interpreter.get(), metadata_feature_win_step_idx)[0]);
+  metadata_exec_plan.push_back(find_parent_node_ids(interpreter.get(), metadata_alphabet_idx)[0]);
 
   for (int i = 0; i < metadata_exec_plan.size(); ++i) {
     assert(metadata_exec_plan[i] > -1);
   }
 
   // When we call Interpreter::Invoke, the whole graph is executed by default,
-  // which means every time compute_mfcc is called the entire acoustic model is
+  // which means every time compute_mfcc_graph is called the entire acoustic model is
   // also executed. To workaround that problem, we walk up the dependency DAG
   // from the mfccs output tensor to find all the relevant nodes required for
   // feature computation, building an execution plan that runs just those nodes.
-  auto mfcc_plan = find_parent_node_ids(mfccs_idx_);
-  auto orig_plan = interpreter_->execution_plan();
+  auto mfcc_plan = find_parent_node_ids(interpreter.get(), mfccs_idx_);
+  auto orig_plan = interpreter->execution_plan();
 
   // Remove MFCC and Metatda nodes from original plan (all nodes) to create the acoustic model plan
   auto erase_begin = std::remove_if(orig_plan.begin(), orig_plan.end(), [&mfcc_plan, &metadata_exec_plan](int elem) {
@@ -160,14 +271,14 @@ TFLiteModelState::init(const char* model_path,
   acoustic_exec_plan_ = std::move(orig_plan);
   mfcc_exec_plan_ = std::move(mfcc_plan);
 
-  interpreter_->SetExecutionPlan(metadata_exec_plan);
-  TfLiteStatus status = interpreter_->Invoke();
+  interpreter->SetExecutionPlan(metadata_exec_plan);
+  TfLiteStatus status = interpreter->Invoke();
   if (status != kTfLiteOk) {
     std::cerr << "Error running session: " << status << "\n";
     return DS_ERR_FAIL_INTERPRETER;
   }
 
-  int* const graph_version = interpreter_->typed_tensor<int>(metadata_version_idx);
+  int* const graph_version = interpreter->typed_tensor<int>(metadata_version_idx);
   if (graph_version == nullptr) {
     std::cerr << "Unable to read model file version." << std::endl;
     return DS_ERR_MODEL_INCOMPATIBLE;
@@ -183,7 +294,7 @@ TFLiteModelState::init(const char* model_path,
     return DS_ERR_MODEL_INCOMPATIBLE;
   }
 
-  int* const model_sample_rate = interpreter_->typed_tensor<int>(metadata_sample_rate_idx);
+  int* const model_sample_rate = interpreter->typed_tensor<int>(metadata_sample_rate_idx);
   if (model_sample_rate == nullptr) {
     std::cerr << "Unable to read model sample rate." << std::endl;
     return DS_ERR_MODEL_INCOMPATIBLE;
@@ -191,8 +302,8 @@ TFLiteModelState::init(const char* model_path,
 
   sample_rate_ = *model_sample_rate;
 
-  int* const win_len_ms  = interpreter_->typed_tensor<int>(metadata_feature_win_len_idx);
-  int* const win_step_ms = interpreter_->typed_tensor<int>(metadata_feature_win_step_idx);
+  int* const win_len_ms  = interpreter->typed_tensor<int>(metadata_feature_win_len_idx);
+  int* const win_step_ms = interpreter->typed_tensor<int>(metadata_feature_win_step_idx);
   if (win_len_ms == nullptr || win_step_ms == nullptr) {
     std::cerr << "Unable to read model feature window informations." << std::endl;
     return DS_ERR_MODEL_INCOMPATIBLE;
@@ -201,7 +312,7 @@ TFLiteModelState::init(const char* model_path,
   audio_win_len_  = sample_rate_ * (*win_len_ms / 1000.0);
   audio_win_step_ = sample_rate_ * (*win_step_ms / 1000.0);
 
-  tflite::StringRef serialized_alphabet = tflite::GetString(interpreter_->tensor(metadata_alphabet_idx), 0);
+  tflite::StringRef serialized_alphabet = tflite::GetString(interpreter->tensor(metadata_alphabet_idx), 0);
   err = alphabet_.deserialize(serialized_alphabet.str, serialized_alphabet.len);
   if (err != 0) {
     return DS_ERR_INVALID_ALPHABET;
@@ -211,14 +322,22 @@ TFLiteModelState::init(const char* model_path,
   assert(audio_win_len_ > 0);
   assert(audio_win_step_ > 0);
 
-  TfLiteIntArray* dims_input_node = interpreter_->tensor(input_node_idx_)->dims;
+  TfLiteIntArray* dims_input_node = interpreter->tensor(input_node_idx_)->dims;
 
+  // Tensors are allocated with the shapes of the model, whose batch dimension
+  // must thus be fixed
+  if (dims_input_node->data[0] < 1) {
+    std::cerr << "Error: Model has no fixed batch size, export it with "
+              << "--export_batch_size." << std::endl;
+    return DS_ERR_MODEL_INCOMPATIBLE;
+  }
+  batch_size_ = dims_input_node->data[0];
   n_steps_ = dims_input_node->data[1];
   n_context_ = (dims_input_node->data[2] - 1) / 2;
   n_features_ = dims_input_node->data[3];
   mfcc_feats_per_timestep_ = dims_input_node->data[2] * dims_input_node->data[3];
 
-  TfLiteIntArray* dims_logits = interpreter_->tensor(logits_idx_)->dims;
+  TfLiteIntArray* dims_logits = interpreter->tensor(logits_idx_)->dims;
   const int final_dim_size = dims_logits->data[1] - 1;
   if (final_dim_size != alphabet_.GetSize()) {
     std::cerr << "Error: Alphabet size does not match loaded model: alphabet "
@@ -230,47 +349,75 @@ TFLiteModelState::init(const char* model_path,
     return DS_ERR_INVALID_ALPHABET;
   }
 
-  TfLiteIntArray* dims_c = interpreter_->tensor(previous_state_c_idx_)->dims;
-  TfLiteIntArray* dims_h = interpreter_->tensor(previous_state_h_idx_)->dims;
+  TfLiteIntArray* dims_c = interpreter->tensor(previous_state_c_idx_)->dims;
+  TfLiteIntArray* dims_h = interpreter->tensor(previous_state_h_idx_)->dims;
   assert(dims_c->data[1] == dims_h->data[1]);
   assert(state_size_ > 0);
   state_size_ = dims_c->data[1];
 
+  // Inputs are read in place from buffers holding a single sequence
+  in_place_infer_ = batch_size_ == 1;
+
+  {
+    std::lock_guard<std::mutex> lock(interpreters_mutex_);
+    idle_interpreters_.push_back(std::move(interpreter));
+    n_interpreters_ = 1;
+  }
+
+  init_native_mfcc();
+
   return DS_ERR_OK;
 }
 
-// Copy contents of vec into the tensor with index tensor_idx.
-// If vec.size() < num_elements, set the remainder of the tensor values to zero.
+// Copy contents of vec into the tensor with index tensor_idx, which holds
+// num_elements values. If vec is shorter, the remainder of the tensor is zeroed.
 void
-TFLiteModelState::copy_vector_to_tensor(const vector<float>& vec,
+TFLiteModelState::copy_vector_to_tensor(Interpreter* interpreter,
+                                        const vector<float>& vec,
                                         int tensor_idx,
                                         int num_elements)
 {
-  float* tensor = interpreter_->typed_tensor<float>(tensor_idx);
-  int i;
-  for (i = 0; i < vec.size(); ++i) {
-    tensor[i] = vec[i];
-  }
-  for (; i < num_elements; ++i) {
-    tensor[i] = 0.f;
-  }
+  float* tensor = interpreter->typed_tensor<float>(tensor_idx);
+  const size_t count = std::min<size_t>(vec.size(), num_elements);
+  std::copy_n(vec.data(), count, tensor);
+  std::fill(tensor + count, tensor + num_elements, 0.f);
+}
+
+// Make the input tensor with index tensor_idx read its values from buffer,
+// which must hold as many. Type and shape are unchanged, so the interpreter
+// keeps its allocations and execution plan.
+bool
+TFLiteModelState::set_input_tensor_buffer(Interpreter* interpreter,
+                                          int tensor_idx,
+                                          const void* buffer)
+{
+  const TfLiteTensor* tensor = interpreter->tensor(tensor_idx);
+  const vector<int> dims(tensor->dims->data, tensor->dims->data + tensor->dims->size);
+  TfLiteStatus status = interpreter->SetTensorParametersReadOnly(tensor_idx,
+                                                                 tensor->type,
+                                                                 tensor->name,
+                                                                 dims,
+                                                                 tensor->params,
+                                                                 static_cast<const char*>(buffer),
+                                                                 tensor->bytes);
+  return status == kTfLiteOk;
 }
 
-// Copy num_elements elements from the tensor with index tensor_idx into vec
+// Append num_elements elements from the tensor with index tensor_idx to vec
 void
-TFLiteModelState::copy_tensor_to_vector(int tensor_idx,
+TFLiteModelState::copy_tensor_to_vector(Interpreter* interpreter,
+                                        int tensor_idx,
                                         int num_elements,
                                         vector<float>& vec)
 {
-  float* tensor = interpreter_->typed_tensor<float>(tensor_idx);
-  for (int i = 0; i < num_elements; ++i) {
-    vec.push_back(tensor[i]);
-  }
+  const float* tensor = interpreter->typed_tensor<float>(tensor_idx);
+  vec.insert(vec.end(), tensor, tensor + num_elements);
 }
 
 void
 TFLiteModelState::infer(const vector<float>& mfcc,
-                        unsigned int n_frames,
+                        unsigned int n_steps,
+                        const vector<unsigned int>& n_frames,
                         const vector<float>& previous_state_c,
                         const vector<float>& previous_state_h,
                         vector<float>& logits_output,
@@ -278,48 +425,123 @@ TFLiteModelState::infer(const vector<float>& mfcc,
                         vector<float>& state_h_output)
 {
   const size_t num_classes = alphabet_.GetSize() + 1; // +1 for blank
+  const unsigned int n_sequences = n_frames.size();
+  assert(n_sequences > 0 && n_sequences <= batch_size_);
+  // The graph is a static RNN, unrolled for exactly n_steps_ timesteps
+  assert(n_steps == n_steps_);
+
+  ScopedInterpreter scoped_interpreter(this);
+  Interpreter* interpreter = scoped_interpreter.get();
+  if (!interpreter) {
+    return;
+  }
 
   // Feeding input_node
-  copy_vector_to_tensor(mfcc, input_node_idx_, n_frames*mfcc_feats_per_timestep_);
+  copy_vector_to_tensor(interpreter, mfcc, input_node_idx_, batch_size_*n_steps_*mfcc_feats_per_timestep_);
 
   // Feeding previous_state_c, previous_state_h
-  assert(previous_state_c.size() == state_size_);
-  copy_vector_to_tensor(previous_state_c, previous_state_c_idx_, state_size_);
-  assert(previous_state_h.size() == state_size_);
-  copy_vector_to_tensor(previous_state_h, previous_state_h_idx_, state_size_);
+  assert(previous_state_c.size() == n_sequences * state_size_);
+  copy_vector_to_tensor(interpreter, previous_state_c, previous_state_c_idx_, batch_size_ * state_size_);
+  assert(previous_state_h.size() == n_sequences * state_size_);
+  copy_vector_to_tensor(interpreter, previous_state_h, previous_state_h_idx_, batch_size_ * state_size_);
 
-  interpreter_->SetExecutionPlan(acoustic_exec_plan_);
-  TfLiteStatus status = interpreter_->Invoke();
+  interpreter->SetExecutionPlan(acoustic_exec_plan_);
+  TfLiteStatus status = interpreter->Invoke();
   if (status != kTfLiteOk) {
     std::cerr << "Error running session: " << status << "\n";
     return;
   }
 
-  copy_tensor_to_vector(logits_idx_, n_frames * BATCH_SIZE * num_classes, logits_output);
+  // Logits are time-major, [n_steps * batch_size, num_classes], reorder them
+  // so that each sequence is contiguous
+  float* logits = interpreter->typed_tensor<float>(logits_idx_);
+  logits_output.resize(n_sequences * n_steps_ * num_classes);
+  for (unsigned int b = 0; b < n_sequences; ++b) {
+    for (unsigned int t = 0; t < n_steps_; ++t) {
+      std::copy_n(logits + (t * batch_size_ + b) * num_classes,
+                  num_classes,
+                  logits_output.begin() + (b * n_steps_ + t) * num_classes);
+    }
+  }
 
   state_c_output.clear();
-  state_c_output.reserve(state_size_);
-  copy_tensor_to_vector(new_state_c_idx_, state_size_, state_c_output);
+  copy_tensor_to_vector(interpreter, new_state_c_idx_, n_sequences * state_size_, state_c_output);
 
   state_h_output.clear();
-  state_h_output.reserve(state_size_);
-  copy_tensor_to_vector(new_state_h_idx_, state_size_, state_h_output);
+  copy_tensor_to_vector(interpreter, new_state_h_idx_, n_sequences * state_size_, state_h_output);
 }
 
 void
-TFLiteModelState::compute_mfcc(const vector<float>& samples,
-                               vector<float>& mfcc_output)
+TFLiteModelState::infer_in_place(const float* mfcc,
+                                 unsigned int n_frames,
+                                 float* state_c,
+                                 float* state_h,
+                                 vector<float>& logits_output)
 {
+  const size_t num_classes = alphabet_.GetSize() + 1; // +1 for blank
+  assert(in_place_infer_);
+
+  ScopedInterpreter scoped_interpreter(this);
+  Interpreter* interpreter = scoped_interpreter.get();
+  if (!interpreter) {
+    return;
+  }
+
+  // Point input_node, previous_state_c and previous_state_h at the buffers of
+  // the caller. They are pointed back at the memory of the interpreter once
+  // done, where infer() copies its inputs.
+  const char* input_node = interpreter->tensor(input_node_idx_)->data.raw;
+  const char* previous_state_c = interpreter->tensor(previous_state_c_idx_)->data.raw;
+  const char* previous_state_h = interpreter->tensor(previous_state_h_idx_)->data.raw;
+
+  TfLiteStatus status = kTfLiteError;
+  if (set_input_tensor_buffer(interpreter, input_node_idx_, mfcc) &&
+      set_input_tensor_buffer(interpreter, previous_state_c_idx_, state_c) &&
+      set_input_tensor_buffer(interpreter, previous_state_h_idx_, state_h)) {
+    interpreter->SetExecutionPlan(acoustic_exec_plan_);
+    status = interpreter->Invoke();
+  }
+
+  set_input_tensor_buffer(interpreter, input_node_idx_, input_node);
+  set_input_tensor_buffer(interpreter, previous_state_c_idx_, previous_state_c);
+  set_input_tensor_buffer(interpreter, previous_state_h_idx_, previous_state_h);
+
+  if (status != kTfLiteOk) {
+    std::cerr << "Error running session: " << status << "\n";
+    return;
+  }
+
+  // With a single sequence, logits are already contiguous
+  const float* logits = interpreter->typed_tensor<float>(logits_idx_);
+  logits_output.assign(logits, logits + n_steps_ * num_classes);
+
+  // Outputs live in the arena of the interpreter, whose memory is reused by
+  // intermediate tensors during the next run, so the new state is copied out
+  // over the previous one, which has been consumed
+  std::copy_n(interpreter->typed_tensor<float>(new_state_c_idx_), state_size_, state_c);
+  std::copy_n(interpreter->typed_tensor<float>(new_state_h_idx_), state_size_, state_h);
+}
+
+void
+TFLiteModelState::compute_mfcc_graph(const vector<float>& samples,
+                                     vector<float>& mfcc_output)
+{
+  ScopedInterpreter scoped_interpreter(this);
+  Interpreter* interpreter = scoped_interpreter.get();
+  if (!interpreter) {
+    return;
+  }
+
   // Feeding input_node
-  copy_vector_to_tensor(samples, input_samples_idx_, samples.size());
+  copy_vector_to_tensor(interpreter, samples, input_samples_idx_, samples.size());
 
-  TfLiteStatus status = interpreter_->SetExecutionPlan(mfcc_exec_plan_);
+  TfLiteStatus status = interpreter->SetExecutionPlan(mfcc_exec_plan_);
   if (status != kTfLiteOk) {
     std::cerr << "Error setting execution plan: " << status << "\n";
     return;
   }
 
-  status = interpreter_->Invoke();
+  status = interpreter->Invoke();
   if (status != kTfLiteOk) {
     std::cerr << "Error running session: " << status << "\n";
     return;
@@ -327,12 +549,12 @@ TFLiteModelState::compute_mfcc(const vector<float>& samples,
 
   // The feature computation graph is hardcoded to one audio length for now
   int n_windows = 1;
-  TfLiteIntArray* out_dims = interpreter_->tensor(mfccs_idx_)->dims;
+  TfLiteIntArray* out_dims = interpreter->tensor(mfccs_idx_)->dims;
   int num_elements = 1;
   for (int i = 0; i < out_dims->size; ++i) {
     num_elements *= out_dims->data[i];
   }
   assert(num_elements / n_features_ == n_windows);
 
-  copy_tensor_to_vector(mfccs_idx_, n_windows * n_features_, mfcc_output);
+  copy_tensor_to_vector(interpreter, mfccs_idx_, n_windows * n_features_, mfcc_output);
 }
@@ -1,7 +1,9 @@
 #ifndef TFLITEMODELSTATE_H
 #define TFLITEMODELSTATE_H
 
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include "tensorflow/lite/model.h"
@@ -11,9 +13,18 @@
 
 struct TFLiteModelState : public ModelState
 {
-  std::unique_ptr<tflite::Interpreter> interpreter_;
+  // Shared read-only by all the interpreters
   std::unique_ptr<tflite::FlatBufferModel> fbmodel_;
 
+  // An interpreter can only run one call at a time, so concurrent calls each
+  // check out an interpreter of the pool. Interpreters are created lazily, up
+  // to max_interpreters_, and calls wait for one to be returned beyond that.
+  std::vector<std::unique_ptr<tflite::Interpreter>> idle_interpreters_;
+  unsigned int n_interpreters_;
+  unsigned int max_interpreters_;
+  std::mutex interpreters_mutex_;
+  std::condition_variable interpreters_cv_;
+
   int input_node_idx_;
   int previous_state_c_idx_;
   int previous_state_h_idx_;
@@ -33,26 +44,48 @@ struct TFLiteModelState : public ModelState
   virtual int init(const char* model_path,
                    unsigned int beam_width) override;
 
-  virtual void compute_mfcc(const std::vector<float>& audio_buffer,
-                            std::vector<float>& mfcc_output) override;
+  virtual int set_max_concurrency(unsigned int max_concurrency) override;
+
+  virtual void compute_mfcc_graph(const std::vector<float>& audio_buffer,
+                                  std::vector<float>& mfcc_output) override;
 
   virtual void infer(const std::vector<float>& mfcc,
-                     unsigned int n_frames,
+                     unsigned int n_steps,
+                     const std::vector<unsigned int>& n_frames,
                      const std::vector<float>& previous_state_c,
                      const std::vector<float>& previous_state_h,
                      std::vector<float>& logits_output,
                      std::vector<float>& state_c_output,
                      std::vector<float>& state_h_output) override;
 
+  virtual void infer_in_place(const float* mfcc,
+                              unsigned int n_frames,
+                              float* state_c,
+                              float* state_h,
+                              std::vector<float>& logits_output) override;
+
 private:
-  int get_tensor_by_name(const std::vector<int>& list, const char* name);
-  int get_input_tensor_by_name(const char* name);
-  int get_output_tensor_by_name(const char* name);
-  std::vector<int> find_parent_node_ids(int tensor_id);
-  void copy_vector_to_tensor(const std::vector<float>& vec,
+  class ScopedInterpreter;
+
+  std::unique_ptr<tflite::Interpreter> new_interpreter();
+  std::unique_ptr<tflite::Interpreter> acquire_interpreter();
+  void release_interpreter(std::unique_ptr<tflite::Interpreter> interpreter);
+
+  int get_tensor_by_name(tflite::Interpreter* interpreter,
+                         const std::vector<int>& list,
+                         const char* name);
+  int get_input_tensor_by_name(tflite::Interpreter* interpreter, const char* name);
+  int get_output_tensor_by_name(tflite::Interpreter* interpreter, const char* name);
+  std::vector<int> find_parent_node_ids(tflite::Interpreter* interpreter, int tensor_id);
+  void copy_vector_to_tensor(tflite::Interpreter* interpreter,
+                             const std::vector<float>& vec,
                              int tensor_idx,
                              int num_elements);
-  void copy_tensor_to_vector(int tensor_idx,
+  bool set_input_tensor_buffer(tflite::Interpreter* interpreter,
+                               int tensor_idx,
+                               const void* buffer);
+  void copy_tensor_to_vector(tflite::Interpreter* interpreter,
+                             int tensor_idx,
                              int num_elements,
                              std::vector<float>& vec);
 };
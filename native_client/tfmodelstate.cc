@@ -1,5 +1,7 @@
 #include "tfmodelstate.h"
 
+#include <algorithm>
+
 #include "workspace_status.h"
 
 using namespace tensorflow;
@@ -9,12 +11,19 @@ TFModelState::TFModelState()
   : ModelState()
   , mmap_env_(nullptr)
   , session_(nullptr)
+  , infer_callable_(0)
+  , mfcc_callable_(0)
+  , has_callables_(false)
 {
 }
 
 TFModelState::~TFModelState()
 {
   if (session_) {
+    if (has_callables_) {
+      session_->ReleaseCallable(infer_callable_);
+      session_->ReleaseCallable(mfcc_callable_);
+    }
     Status status = session_->Close();
     if (!status.ok()) {
       std::cerr << "Error closing TensorFlow session: " << status << std::endl;
@@ -35,6 +44,10 @@ TFModelState::init(const char* model_path,
   Status status;
   SessionOptions options;
 
+  options.config.set_intra_op_parallelism_threads(intra_op_threads_);
+  options.config.set_inter_op_parallelism_threads(inter_op_threads_);
+  options.config.set_use_per_session_threads(per_model_thread_pools_);
+
   mmap_env_ = new MemmappedEnv(Env::Default());
 
   bool is_mmap = std::string(model_path).find(".pbmm") != std::string::npos;
@@ -129,7 +142,10 @@ TFModelState::init(const char* model_path,
     NodeDef node = graph_def_.node(i);
     if (node.name() == "input_node") {
       const auto& shape = node.attr().at("shape").shape();
+      // A dynamic batch dimension is -1, run such graphs one sequence at a time
+      batch_size_ = std::max<long long>(shape.dim(0).size(), 1);
       n_steps_ = shape.dim(1).size();
+      dynamic_steps_ = shape.dim(1).size() == -1;
       n_context_ = (shape.dim(2).size()-1)/2;
       n_features_ = shape.dim(3).size();
       mfcc_feats_per_timestep_ = shape.dim(2).size() * shape.dim(3).size();
@@ -163,39 +179,124 @@ TFModelState::init(const char* model_path,
     return DS_ERR_INVALID_SHAPE;
   }
 
+  if (dynamic_steps_) {
+    // The time dimension is not fixed by the graph, streaming uses the number
+    // of steps it was exported with
+    std::vector<tensorflow::Tensor> n_steps_output;
+    status = session_->Run({}, {"metadata_n_steps"}, {}, &n_steps_output);
+    if (!status.ok()) {
+      std::cerr << "Unable to fetch number of steps of a model with a dynamic "
+                << "time dimension: " << status << std::endl;
+      return DS_ERR_MODEL_INCOMPATIBLE;
+    }
+    n_steps_ = n_steps_output[0].scalar<int>()();
+  }
+
+  err = make_callables();
+  if (err != DS_ERR_OK) {
+    return err;
+  }
+
+  init_native_mfcc();
+
+  return DS_ERR_OK;
+}
+
+int
+TFModelState::make_callables()
+{
+  CallableOptions infer_options;
+  infer_options.add_feed("input_node");
+  infer_options.add_feed("input_lengths");
+  infer_options.add_feed("previous_state_c");
+  infer_options.add_feed("previous_state_h");
+  infer_options.add_fetch("logits");
+  infer_options.add_fetch("new_state_c");
+  infer_options.add_fetch("new_state_h");
+
+  Status status = session_->MakeCallable(infer_options, &infer_callable_);
+  if (!status.ok()) {
+    std::cerr << "Unable to prepare acoustic model inference: " << status << std::endl;
+    return DS_ERR_FAIL_CREATE_SESS;
+  }
+
+  CallableOptions mfcc_options;
+  mfcc_options.add_feed("input_samples");
+  mfcc_options.add_fetch("mfccs");
+
+  status = session_->MakeCallable(mfcc_options, &mfcc_callable_);
+  if (!status.ok()) {
+    session_->ReleaseCallable(infer_callable_);
+    std::cerr << "Unable to prepare feature computation: " << status << std::endl;
+    return DS_ERR_FAIL_CREATE_SESS;
+  }
+
+  has_callables_ = true;
   return DS_ERR_OK;
 }
 
-Tensor
-tensor_from_vector(const std::vector<float>& vec, const TensorShape& shape)
+std::unique_ptr<TFModelState::InferFeeds>
+TFModelState::acquire_feeds(unsigned int n_steps)
 {
-  Tensor ret(DT_FLOAT, shape);
-  auto ret_mapped = ret.flat<float>();
-  int i;
-  for (i = 0; i < vec.size(); ++i) {
-    ret_mapped(i) = vec[i];
+  std::unique_ptr<InferFeeds> feeds;
+  {
+    std::lock_guard<std::mutex> lock(feeds_mutex_);
+    if (!idle_feeds_.empty()) {
+      feeds = std::move(idle_feeds_.back());
+      idle_feeds_.pop_back();
+    }
+  }
+
+  if (!feeds) {
+    feeds.reset(new InferFeeds());
+    feeds->n_steps = 0;
+    feeds->tensors.resize(4);
+    feeds->tensors[1] = Tensor(DT_INT32, TensorShape({batch_size_}));
+    feeds->tensors[2] = Tensor(DT_FLOAT, TensorShape({batch_size_, (long long)state_size_}));
+    feeds->tensors[3] = Tensor(DT_FLOAT, TensorShape({batch_size_, (long long)state_size_}));
   }
-  for (; i < shape.num_elements(); ++i) {
-    ret_mapped(i) = 0.f;
+
+  // The time dimension only changes with models taking a dynamic one
+  if (feeds->n_steps != n_steps) {
+    feeds->tensors[0] = Tensor(DT_FLOAT, TensorShape({batch_size_, n_steps, 2*n_context_+1, n_features_}));
+    feeds->n_steps = n_steps;
   }
-  return ret;
+
+  return feeds;
+}
+
+void
+TFModelState::release_feeds(std::unique_ptr<InferFeeds> feeds)
+{
+  std::lock_guard<std::mutex> lock(feeds_mutex_);
+  idle_feeds_.push_back(std::move(feeds));
+}
+
+// Copy vec into the memory of tensor, zero-filling the rest of it
+void
+copy_vector_to_tensor(const std::vector<float>& vec, Tensor& tensor)
+{
+  float* data = tensor.flat<float>().data();
+  const size_t num_elements = tensor.NumElements();
+  const size_t count = std::min(vec.size(), num_elements);
+  std::copy_n(vec.data(), count, data);
+  std::fill(data + count, data + num_elements, 0.f);
 }
 
 void
 copy_tensor_to_vector(const Tensor& tensor, vector<float>& vec, int num_elements = -1)
 {
-  auto tensor_mapped = tensor.flat<float>();
+  const float* data = tensor.flat<float>().data();
   if (num_elements == -1) {
-    num_elements = tensor.shape().num_elements();
-  }
-  for (int i = 0; i < num_elements; ++i) {
-    vec.push_back(tensor_mapped(i));
+    num_elements = tensor.NumElements();
   }
+  vec.insert(vec.end(), data, data + num_elements);
 }
 
 void
 TFModelState::infer(const std::vector<float>& mfcc,
-                    unsigned int n_frames,
+                    unsigned int n_steps,
+                    const std::vector<unsigned int>& n_frames,
                     const std::vector<float>& previous_state_c,
                     const std::vector<float>& previous_state_h,
                     vector<float>& logits_output,
@@ -203,49 +304,62 @@ TFModelState::infer(const std::vector<float>& mfcc,
                     vector<float>& state_h_output)
 {
   const size_t num_classes = alphabet_.GetSize() + 1; // +1 for blank
-
-  Tensor input = tensor_from_vector(mfcc, TensorShape({BATCH_SIZE, n_steps_, 2*n_context_+1, n_features_}));
-  Tensor previous_state_c_t = tensor_from_vector(previous_state_c, TensorShape({BATCH_SIZE, (long long)state_size_}));
-  Tensor previous_state_h_t = tensor_from_vector(previous_state_h, TensorShape({BATCH_SIZE, (long long)state_size_}));
-
-  Tensor input_lengths(DT_INT32, TensorShape({1}));
-  input_lengths.scalar<int>()() = n_frames;
+  const unsigned int n_sequences = n_frames.size();
+  assert(n_sequences > 0 && n_sequences <= batch_size_);
+  assert(dynamic_steps_ || n_steps == n_steps_);
+
+  std::unique_ptr<InferFeeds> feeds = acquire_feeds(n_steps);
+  copy_vector_to_tensor(mfcc, feeds->tensors[0]);
+  copy_vector_to_tensor(previous_state_c, feeds->tensors[2]);
+  copy_vector_to_tensor(previous_state_h, feeds->tensors[3]);
+
+  // Unused sequences of the batch are zero-filled and zero-length
+  auto input_lengths_mapped = feeds->tensors[1].vec<int>();
+  for (unsigned int i = 0; i < batch_size_; ++i) {
+    input_lengths_mapped(i) = i < n_sequences ? n_frames[i] : 0;
+  }
 
   vector<Tensor> outputs;
-  Status status = session_->Run(
-    {
-     {"input_node", input},
-     {"input_lengths", input_lengths},
-     {"previous_state_c", previous_state_c_t},
-     {"previous_state_h", previous_state_h_t}
-    },
-    {"logits", "new_state_c", "new_state_h"},
-    {},
-    &outputs);
+  Status status = session_->RunCallable(infer_callable_, feeds->tensors, &outputs, nullptr);
 
   if (!status.ok()) {
     std::cerr << "Error running session: " << status << "\n";
+    release_feeds(std::move(feeds));
     return;
   }
 
-  copy_tensor_to_vector(outputs[0], logits_output, n_frames * BATCH_SIZE * num_classes);
+  // Logits are time-major, [n_steps, batch_size, num_classes], reorder them so
+  // that each sequence is contiguous
+  const float* logits = outputs[0].flat<float>().data();
+  logits_output.resize(n_sequences * n_steps * num_classes);
+  for (unsigned int b = 0; b < n_sequences; ++b) {
+    for (unsigned int t = 0; t < n_steps; ++t) {
+      std::copy_n(logits + (t * batch_size_ + b) * num_classes,
+                  num_classes,
+                  logits_output.begin() + (b * n_steps + t) * num_classes);
+    }
+  }
 
   state_c_output.clear();
-  state_c_output.reserve(state_size_);
-  copy_tensor_to_vector(outputs[1], state_c_output);
+  state_c_output.reserve(n_sequences * state_size_);
+  copy_tensor_to_vector(outputs[1], state_c_output, n_sequences * state_size_);
 
   state_h_output.clear();
-  state_h_output.reserve(state_size_);
-  copy_tensor_to_vector(outputs[2], state_h_output);
+  state_h_output.reserve(n_sequences * state_size_);
+  copy_tensor_to_vector(outputs[2], state_h_output, n_sequences * state_size_);
+
+  // Only give the feeds back once outputs, which could alias them, are copied
+  release_feeds(std::move(feeds));
 }
 
 void
-TFModelState::compute_mfcc(const vector<float>& samples, vector<float>& mfcc_output)
+TFModelState::compute_mfcc_graph(const vector<float>& samples, vector<float>& mfcc_output)
 {
-  Tensor input = tensor_from_vector(samples, TensorShape({audio_win_len_}));
+  Tensor input(DT_FLOAT, TensorShape({audio_win_len_}));
+  copy_vector_to_tensor(samples, input);
 
   vector<Tensor> outputs;
-  Status status = session_->Run({{"input_samples", input}}, {"mfccs"}, {}, &outputs);
+  Status status = session_->RunCallable(mfcc_callable_, {input}, &outputs, nullptr);
 
   if (!status.ok()) {
     std::cerr << "Error running session: " << status << "\n";
@@ -1,6 +1,8 @@
 #ifndef TFMODELSTATE_H
 #define TFMODELSTATE_H
 
+#include <memory>
+#include <mutex>
 #include <vector>
 
 #include "tensorflow/core/public/session.h"
@@ -15,6 +17,22 @@ struct TFModelState : public ModelState
   tensorflow::Session* session_;
   tensorflow::GraphDef graph_def_;
 
+  // Feeds and fetches of the acoustic model and feature computation are
+  // resolved once, when creating these callables
+  tensorflow::Session::CallableHandle infer_callable_;
+  tensorflow::Session::CallableHandle mfcc_callable_;
+  bool has_callables_;
+
+  // Input tensors of infer(), allocated once and reused. Concurrent calls each
+  // check out their own set, more are allocated when none is idle.
+  struct InferFeeds {
+    unsigned int n_steps;
+    // input_node, input_lengths, previous_state_c, previous_state_h
+    std::vector<tensorflow::Tensor> tensors;
+  };
+  std::vector<std::unique_ptr<InferFeeds>> idle_feeds_;
+  std::mutex feeds_mutex_;
+
   TFModelState();
   virtual ~TFModelState();
 
@@ -22,15 +40,21 @@ struct TFModelState : public ModelState
                    unsigned int beam_width) override;
 
   virtual void infer(const std::vector<float>& mfcc,
-                     unsigned int n_frames,
+                     unsigned int n_steps,
+                     const std::vector<unsigned int>& n_frames,
                      const std::vector<float>& previous_state_c,
                      const std::vector<float>& previous_state_h,
                      std::vector<float>& logits_output,
                      std::vector<float>& state_c_output,
                      std::vector<float>& state_h_output) override;
 
-  virtual void compute_mfcc(const std::vector<float>& audio_buffer,
-                            std::vector<float>& mfcc_output) override;
+  virtual void compute_mfcc_graph(const std::vector<float>& audio_buffer,
+                                  std::vector<float>& mfcc_output) override;
+
+private:
+  int make_callables();
+  std::unique_ptr<InferFeeds> acquire_feeds(unsigned int n_steps);
+  void release_feeds(std::unique_ptr<InferFeeds> feeds);
 };
 
 #endif // TFMODELSTATE_H
@@ -0,0 +1,61 @@
+#ifndef THREADAFFINITY_H
+#define THREADAFFINITY_H
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+/*
+ * Restricts the calling thread to the CPUs set in a mask while in scope, and
+ * restores its previous affinity afterwards. Threads started in the meantime,
+ * such as the thread pools of the inference runtimes, inherit the mask.
+ *
+ * Bit i of the mask stands for CPU i. An empty mask leaves the affinity
+ * unchanged, as does any mask on platforms other than Linux.
+ */
+class ScopedCpuAffinity {
+public:
+  explicit ScopedCpuAffinity(unsigned long long mask)
+    : applied_(false)
+  {
+#ifdef __linux__
+    if (mask == 0) {
+      return;
+    }
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu = 0; cpu < 64; ++cpu) {
+      if (mask & (1ULL << cpu)) {
+        CPU_SET(cpu, &cpus);
+      }
+    }
+
+    // On Linux, pid 0 designates the calling thread
+    if (sched_getaffinity(0, sizeof(previous_), &previous_) == 0) {
+      applied_ = sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+    }
+#endif
+  }
+
+  ~ScopedCpuAffinity()
+  {
+#ifdef __linux__
+    if (applied_) {
+      sched_setaffinity(0, sizeof(previous_), &previous_);
+    }
+#endif
+  }
+
+  // Disallow copying
+  ScopedCpuAffinity(const ScopedCpuAffinity&) = delete;
+  ScopedCpuAffinity& operator=(const ScopedCpuAffinity&) = delete;
+
+private:
+  bool applied_;
+#ifdef __linux__
+  cpu_set_t previous_;
+#endif
+};
+
+#endif // THREADAFFINITY_H
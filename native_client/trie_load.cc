@@ -31,9 +31,12 @@ int main(int argc, char** argv)
 #ifndef DEBUG
   return scorer.init(0.0, 0.0, kenlm_path, trie_path, alphabet);
 #else
-  // Print some info about the FST
-  using FstType = fst::ConstFst<fst::StdArc>;
+  err = scorer.init(0.0, 0.0, kenlm_path, trie_path, alphabet);
+  if (err != 0) {
+    return err;
+  }
 
+  // Print some info about the dictionary
   auto dict = scorer.dictionary.get();
 
   struct state_info {
@@ -43,10 +46,13 @@ int main(int argc, char** argv)
 
   auto print_states_from = [&](int i) {
     std::unordered_map<int, state_info> sinfo;
-    for (fst::ArcIterator<FstType> aiter(*dict, i); !aiter.Done(); aiter.Next()) {
-      const fst::StdArc& arc = aiter.Value();
-      sinfo[arc.nextstate].range_min = std::min(sinfo[arc.nextstate].range_min, arc.ilabel-1);
-      sinfo[arc.nextstate].range_max = std::max(sinfo[arc.nextstate].range_max, arc.ilabel-1);
+    for (int label = 1; label <= dict->max_label(); ++label) {
+      TransitionTable::StateId next;
+      int olabel;
+      if (dict->find(i, label, &next, &olabel)) {
+        sinfo[next].range_min = std::min(sinfo[next].range_min, label-1);
+        sinfo[next].range_max = std::max(sinfo[next].range_max, label-1);
+      }
     }
 
     for (auto it = sinfo.begin(); it != sinfo.end(); ++it) {
@@ -55,7 +61,7 @@ int main(int argc, char** argv)
     }
   };
 
-  print_states_from(0);
+  print_states_from(dict->start());
 
   // for (int i = 1; i < 10; ++i) {
   //   print_states_from(i);
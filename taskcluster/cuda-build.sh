@@ -9,6 +9,7 @@ source ${DS_ROOT_TASK}/DeepSpeech/tf/tc-vars.sh
 BAZEL_TARGETS="
 //native_client:libdeepspeech.so
 //native_client:generate_trie
+//native_client:convert_trie
 "
 
 BAZEL_ENV_FLAGS="TF_NEED_CUDA=1 ${TF_CUDA_FLAGS}"
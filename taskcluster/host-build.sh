@@ -11,6 +11,14 @@ source ${DS_ROOT_TASK}/DeepSpeech/tf/tc-vars.sh
 BAZEL_TARGETS="
 //native_client:libdeepspeech.so
 //native_client:generate_trie
+//native_client:convert_trie
+//native_client:mfcc_test
+//native_client:log_sum_exp_test
+//native_client:transition_table_test
+//native_client:decoder_timestep_test
+//native_client:ringbuffer_benchmark
+//native_client:decoder_benchmark
+//native_client:log_sum_exp_benchmark
 "
 
 if [ "${runtime}" = "tflite" ]; then
@@ -23,6 +31,11 @@ SYSTEM_TARGET=host
 
 do_bazel_build
 
+${DS_ROOT_TASK}/DeepSpeech/tf/bazel-bin/native_client/mfcc_test
+${DS_ROOT_TASK}/DeepSpeech/tf/bazel-bin/native_client/log_sum_exp_test
+${DS_ROOT_TASK}/DeepSpeech/tf/bazel-bin/native_client/transition_table_test
+${DS_ROOT_TASK}/DeepSpeech/tf/bazel-bin/native_client/decoder_timestep_test
+
 do_deepspeech_binary_build
 
 if [ "${runtime}" = "tflite" ]; then
@@ -1310,6 +1310,15 @@ do_deepspeech_decoder_build()
 
     cp native_client/ctcdecode/dist/*.whl wheels
 
+    # Decode through the package just built, when it runs here
+    if [ "${SYSTEM_TARGET}" = "host" ]; then
+      pip install --upgrade native_client/ctcdecode/dist/*.whl
+      python native_client/test/decoder_pool_test.py \
+        --alphabet data/alphabet.txt \
+        --lm data/smoke_test/vocab.pruned.lm \
+        --trie data/smoke_test/vocab.trie
+    fi;
+
     make -C native_client/ctcdecode clean-keep-common
 
     unset NUMPY_BUILD_VERSION
@@ -1471,6 +1480,7 @@ package_native_client()
 
   ${TAR} -cf - \
     -C ${tensorflow_dir}/bazel-bin/native_client/ generate_trie${PLATFORM_EXE_SUFFIX} \
+    -C ${tensorflow_dir}/bazel-bin/native_client/ convert_trie${PLATFORM_EXE_SUFFIX} \
     -C ${tensorflow_dir}/bazel-bin/native_client/ libdeepspeech.so \
     -C ${tensorflow_dir}/bazel-bin/native_client/ libdeepspeech.so.if.lib \
     -C ${deepspeech_dir}/ LICENSE \
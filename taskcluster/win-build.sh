@@ -12,6 +12,7 @@ source ${DS_ROOT_TASK}/DeepSpeech/tf/tc-vars.sh
 BAZEL_TARGETS="
 //native_client:libdeepspeech.so
 //native_client:generate_trie
+//native_client:convert_trie
 "
 
 if [ "${cuda}" = "--cuda" ]; then
@@ -108,6 +108,7 @@ def create_flags():
     f.DEFINE_boolean('remove_export', False, 'whether to remove old exported models')
     f.DEFINE_boolean('export_tflite', False, 'export a graph ready for TF Lite engine')
     f.DEFINE_integer('n_steps', 16, 'how many timesteps to process at once by the export graph, higher values mean more latency')
+    f.DEFINE_boolean('export_dynamic_steps', False, 'export a graph accepting any number of timesteps per run, n_steps is then only used for streaming. Allows faster offline inference, not supported with TF Lite')
     f.DEFINE_string('export_language', '', 'language the model was trained on e.g. "en" or "English". Gets embedded into exported model.')
     f.DEFINE_boolean('export_zip', False, 'export a TFLite model and package with LM and info.json')
 
@@ -151,6 +152,7 @@ def create_flags():
     f.DEFINE_float('lm_beta', 1.85, 'the beta hyperparameter of the CTC decoder. Word insertion weight.')
     f.DEFINE_float('cutoff_prob', 1.0, 'only consider characters until this probability mass is reached. 1.0 = disabled.')
     f.DEFINE_integer('cutoff_top_n', 300, 'only process this number of characters sorted by probability mass for each time step. If bigger than alphabet size, disabled.')
+    f.DEFINE_float('blank_skip_threshold', 1.0, 'skip extending the beam at time steps where the blank probability is above this value. 1.0 = disabled.')
 
     # Inference mode
 
@@ -165,3 +167,9 @@ def create_flags():
     f.register_validator('one_shot_infer',
                          lambda value: not value or os.path.isfile(value),
                          message='The file pointed to by --one_shot_infer must exist and be readable.')
+
+    # Register validators for decoder parameters with a restricted range
+
+    f.register_validator('blank_skip_threshold',
+                         lambda value: 0.0 <= value <= 1.0,
+                         message='--blank_skip_threshold must be a probability, between 0 and 1.')